@@ -0,0 +1,225 @@
+/*
+ * bench.c - Statistically robust benchmarking of a function f
+ *
+ * Unlike the K-best scheme in fcyc.c, which keeps only the smallest
+ * samples, and ftimer.c, which returns a mean, bench_run keeps every
+ * sample and reports the median with its median absolute deviation
+ * and a distribution-free confidence interval. Sampling is adaptive:
+ * it stops as soon as the interval is narrow enough. bench_compare
+ * tells whether two sets of samples differ by more than noise.
+ */
+#define _GNU_SOURCE  /* for sched_setaffinity */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+
+#include "bench.h"
+#include "clock.h"
+
+#define Z95 1.959964   /* two-sided 95% quantile of the normal distribution */
+
+/* 
+ * cmp_double - qsort comparison function for an array of doubles 
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* 
+ * median_of - median of a sorted array 
+ */
+static double median_of(double *v, int n)
+{
+    return (n % 2) ? v[n/2] : 0.5 * (v[n/2 - 1] + v[n/2]);
+}
+
+/*
+ * summarize - Sort the samples and compute the summary statistics.
+ *     The confidence interval of the median uses the order statistics
+ *     n/2 -/+ Z95*sqrt(n)/2, the normal approximation of the binomial
+ *     distribution of the number of samples below the median.
+ */
+static void summarize(bench_result_t *r)
+{
+    int i, lo, hi;
+    double *dev;
+
+    qsort(r->samples, r->n, sizeof(double), cmp_double);
+    r->median = median_of(r->samples, r->n);
+
+    if ((dev = (double *)malloc(r->n * sizeof(double))) == NULL) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in summarize\n");
+	exit(1);
+    }
+    for (i = 0; i < r->n; i++)
+	dev[i] = fabs(r->samples[i] - r->median);
+    qsort(dev, r->n, sizeof(double), cmp_double);
+    r->mad = median_of(dev, r->n);
+    free(dev);
+
+    lo = (int)floor(r->n / 2.0 - Z95 * sqrt(r->n) / 2.0);
+    hi = (int)ceil(r->n / 2.0 + Z95 * sqrt(r->n) / 2.0);
+    r->ci_lo = r->samples[lo < 0 ? 0 : lo];
+    r->ci_hi = r->samples[hi > r->n - 1 ? r->n - 1 : hi];
+}
+
+/*
+ * time_once - Return the running time of one call of f(argp) in secs
+ */
+static double time_once(bench_test_funct f, void *argp)
+{
+    start_counter();
+    f(argp);
+    return get_counter() / (mhz(0) * 1e6);
+}
+
+/*
+ * bench_init_params - Fill in the default parameters
+ */
+void bench_init_params(bench_params_t *params)
+{
+    params->warmup = BENCH_WARMUP;
+    params->min_samples = BENCH_MIN_SAMPLES;
+    params->max_samples = BENCH_MAX_SAMPLES;
+    params->target = BENCH_TARGET;
+}
+
+/*
+ * bench_run - Warm up, then sample f(argp) until the 95% CI of the
+ *     median is within +/- target of the median
+ */
+void bench_run(bench_test_funct f, void *argp, bench_params_t *params,
+	       bench_result_t *result)
+{
+    int i;
+    double *sorted;
+    bench_result_t tmp;
+
+    for (i = 0; i < params->warmup; i++)
+	f(argp);
+
+    result->n = 0;
+    result->samples = (double *)malloc(params->max_samples * sizeof(double));
+    sorted = (double *)malloc(params->max_samples * sizeof(double));
+    if (result->samples == NULL || sorted == NULL) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in bench_run\n");
+	exit(1);
+    }
+
+    /* 
+     * summarize() sorts in place, so the convergence test runs on a 
+     * copy and the samples stay in the order they were taken until the
+     * end 
+     */
+    while (result->n < params->max_samples) {
+	result->samples[result->n++] = time_once(f, argp);
+	if (result->n < params->min_samples)
+	    continue;
+	tmp = *result;
+	memcpy(sorted, result->samples, result->n * sizeof(double));
+	tmp.samples = sorted;
+	summarize(&tmp);
+	if ((tmp.ci_hi - tmp.ci_lo) / 2 <= params->target * tmp.median)
+	    break;
+    }
+    free(sorted);
+    summarize(result);
+}
+
+/*
+ * bench_free - Release the samples held by a result
+ */
+void bench_free(bench_result_t *result)
+{
+    free(result->samples);
+    result->samples = NULL;
+    result->n = 0;
+}
+
+/*
+ * bench_pin_cpu - Pin the calling process to one CPU so that samples
+ *     are not disturbed by migrations
+ */
+int bench_pin_cpu(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);
+#else
+    return -1;
+#endif
+}
+
+/*
+ * bench_compare - Report a change only if the 95% CIs of the two medians
+ *     do not overlap and the medians differ by at least min_effect.
+ *     The samples of one run are taken back to back in one process, so
+ *     they share its heap layout and whatever else the machine was doing
+ *     at the time, and they are not independent: two runs of the same
+ *     build differ by more than their CIs suggest. The minimum effect
+ *     keeps that run-to-run noise out; an A/A run of one build against
+ *     itself shows how large it has to be.
+ */
+int bench_compare(bench_result_t *base, bench_result_t *cur, 
+		  double min_effect, double *change)
+{
+    *change = (cur->median - base->median) / base->median;
+
+    if (fabs(*change) < min_effect)
+	return 0;
+    if (cur->ci_hi < base->ci_lo)
+	return -1;
+    if (cur->ci_lo > base->ci_hi)
+	return 1;
+    return 0;
+}
+
+/*
+ * bench_write - Write a named result as a "name n" line followed by 
+ *     its n samples, one per line
+ */
+void bench_write(FILE *fp, char *name, bench_result_t *result)
+{
+    int i;
+
+    fprintf(fp, "%s %d\n", name, result->n);
+    for (i = 0; i < result->n; i++)
+	fprintf(fp, "%.9e\n", result->samples[i]);
+}
+
+/*
+ * bench_read - Read back the next record written by bench_write
+ */
+int bench_read(FILE *fp, char *name, int namelen, bench_result_t *result)
+{
+    char fmt[32];
+    int i;
+
+    sprintf(fmt, "%%%ds %%d", namelen - 1);
+    if ((i = fscanf(fp, fmt, name, &result->n)) == EOF)
+	return 0;
+    if (i != 2 || result->n < 1)
+	return -1;
+    if ((result->samples = (double *)malloc(result->n * sizeof(double))) 
+	== NULL) {
+	fprintf(stderr, "Fatal error.  Malloc returned null in bench_read\n");
+	exit(1);
+    }
+    for (i = 0; i < result->n; i++) {
+	if (fscanf(fp, "%lf", &result->samples[i]) != 1) {
+	    bench_free(result);
+	    return -1;
+	}
+    }
+    summarize(result);
+    return 1;
+}
@@ -0,0 +1,73 @@
+/*
+ * bench.h - prototypes for the statistically robust benchmark routines
+ *     in bench.c
+ */
+#ifndef __BENCH_H_
+#define __BENCH_H_
+
+#include <stdio.h>
+
+/* Default values */
+#define BENCH_WARMUP       3    /* untimed runs before sampling starts */
+#define BENCH_MIN_SAMPLES 10    /* always take at least this many samples */
+#define BENCH_MAX_SAMPLES 200   /* give up after this many samples */
+#define BENCH_TARGET      0.01  /* wanted CI half-width, relative to median */
+#define BENCH_MIN_EFFECT  0.05  /* smallest relative change worth reporting */
+
+/* The test function takes a generic pointer as input */
+typedef void (*bench_test_funct)(void *);
+
+/* Controls how long bench_run keeps sampling */
+typedef struct {
+    int warmup;       /* untimed warmup runs */
+    int min_samples;  /* minimum number of timed runs */
+    int max_samples;  /* maximum number of timed runs */
+    double target;    /* stop once the 95% CI of the median is within 
+			 +/- target * median */
+} bench_params_t;
+
+/* The samples taken for one benchmark and their summary statistics */
+typedef struct {
+    int n;            /* number of samples */
+    double *samples;  /* run times in secs, sorted ascending */
+    double median;    /* median run time */
+    double mad;       /* median absolute deviation from the median */
+    double ci_lo;     /* distribution-free 95% confidence interval ... */
+    double ci_hi;     /* ... of the median */
+} bench_result_t;
+
+/* Fill in the default parameters */
+void bench_init_params(bench_params_t *params);
+
+/* 
+ * Time f(argp) repeatedly, after warming up, until the median is known
+ * to within the target precision or max_samples is reached 
+ */
+void bench_run(bench_test_funct f, void *argp, bench_params_t *params,
+	       bench_result_t *result);
+
+/* Release the samples held by a result */
+void bench_free(bench_result_t *result);
+
+/* Pin the calling process to one CPU. Returns 0 on success, -1 if not */
+int bench_pin_cpu(int cpu);
+
+/* 
+ * Test whether the run times in cur differ from those in base. Sets
+ * *change to the relative change of the median, (cur - base) / base,
+ * and returns -1 (faster) or 1 (slower) if the 95% CIs of the two
+ * medians do not overlap and |*change| is at least min_effect, else 0.
+ */
+int bench_compare(bench_result_t *base, bench_result_t *cur, 
+		  double min_effect, double *change);
+
+/* Write the samples of a named result to fp, one record per call */
+void bench_write(FILE *fp, char *name, bench_result_t *result);
+
+/* 
+ * Read the next record written by bench_write. Returns 1 on success,
+ * 0 at the end of the file, and -1 if the file is malformed.
+ */
+int bench_read(FILE *fp, char *name, int namelen, bench_result_t *result);
+
+#endif /* __BENCH_H_ */
@@ -0,0 +1,29 @@
+/*
+ * bintrace.h - Binary trace file format
+ *
+ * A binary trace carries the same information as a .rep file, packed
+ * into fixed-size records in host byte order so that traces with
+ * hundreds of millions of requests can be written and read quickly:
+ * one bintrace_hdr_t followed by num_ops bintrace_op_t records.
+ */
+#ifndef __BINTRACE_H_
+#define __BINTRACE_H_
+
+#define BINTRACE_MAGIC "MMTRACE1"   /* 8 bytes, no terminating NUL stored */
+
+typedef struct {
+    char magic[8];          /* BINTRACE_MAGIC */
+    int sugg_heapsize;      /* suggested heap size (unused) */
+    int num_ids;            /* number of request id's */
+    int num_ops;            /* number of requests (operations) */
+    int weight;             /* weight for this trace (unused) */
+} bintrace_hdr_t;
+
+typedef struct {
+    char type;              /* 'a', 'c', 'r' or 'f', as in .rep files */
+    char pad[3];
+    unsigned int index;     /* request id */
+    unsigned int size;      /* byte size of alloc/realloc request */
+} bintrace_op_t;
+
+#endif /* __BINTRACE_H_ */
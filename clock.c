@@ -1,6 +1,7 @@
 /* 
- * clock.c - Routines for using the cycle counters on x86, 
- *           Alpha, and Sparc boxes.
+ * clock.c - Routines for using the cycle counters on x86, x86-64,
+ *           ARM64, and Alpha boxes, with a clock_gettime() fallback
+ *           for every other Unix box.
  * 
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
@@ -9,70 +10,203 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+#ifndef CLOCK_MONOTONIC_RAW
+#define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
+#endif
+
+/* The sources that start_counter()/get_counter() can be driven by */
+#define SRC_UNKNOWN -1  /* not probed yet */
+#define SRC_CLOCK    0  /* clock_gettime(CLOCK_MONOTONIC_RAW), in nsecs */
+#define SRC_TSC      1  /* x86 time-stamp counter, serialized by lfence */
+#define SRC_RDTSCP   2  /* x86 time-stamp counter, read with rdtscp */
+#define SRC_CNTVCT   3  /* ARM64 generic timer virtual count */
+
+static int counter_src = SRC_UNKNOWN;
+static double counter_mhz = 0.0;  /* calibrated counter rate, once known */
+
+/* 
+ * read_clock - the portable fallback counter: nanoseconds of a clock
+ *     that is not slewed by NTP 
+ */
+static unsigned long long read_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 
 /******************************************************* 
  * Machine dependent functions 
  *
- * Note: the constants __i386__ and  __alpha
- * are set by GCC when it calls the C preprocessor
- * You can verify this for yourself using gcc -v.
+ * Note: the constants __i386__, __x86_64__, __aarch64__
+ * and __alpha are set by GCC when it calls the C 
+ * preprocessor. You can verify this for yourself using 
+ * gcc -v.
+ *
+ * Each hardware version provides probe_counter(), which
+ * picks a source and returns its rate in MHz if the 
+ * hardware reports it (0 if it must be calibrated), plus
+ * read_counter() and read_ticks(), the serialized and
+ * the cheap unserialized reads of that source.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 and x86-64 versions 
+ *
+ * The TSC is only usable as a clock if it is invariant,
+ * i.e. it ticks at a constant rate regardless of P- and
+ * C-state changes. rdtsc may be executed out of order, 
+ * so timed regions are fenced with lfence, or read with
+ * rdtscp, which waits for all earlier instructions.
  *******************************************************/
 
-
 /* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
-
-
 /* Set *hi and *lo to the high and low order bits  of the cycle counter.  
    Implementation requires assembly code to use the rdtsc instruction. */
 void access_counter(unsigned *hi, unsigned *lo)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-	: "=r" (*hi), "=r" (*lo)                /* and move results to */
-	: /* No input */                        /* the two outputs */
-	: "%edx", "%eax");
+    if (counter_src == SRC_RDTSCP) {
+	unsigned aux;
+	asm volatile("rdtscp" : "=a" (*lo), "=d" (*hi), "=c" (aux));
+    } else {
+	asm volatile("lfence; rdtsc" : "=a" (*lo), "=d" (*hi));
+    }
 }
+/* $end x86cyclecounter */
 
-/* Record the current value of the cycle counter. */
-void start_counter()
+static int probe_counter(double *rate)
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    unsigned eax, ebx, ecx, edx, max_ext;
+
+    *rate = 0.0;
+    max_ext = __get_cpuid_max(0x80000000, NULL);
+    if (max_ext < 0x80000007)
+	return SRC_CLOCK;
+
+    /* CPUID.80000007H:EDX[8] is the invariant TSC flag */
+    __cpuid(0x80000007, eax, ebx, ecx, edx);
+    if (!(edx & (1 << 8)))
+	return SRC_CLOCK;
+
+    /* CPUID.80000001H:EDX[27] says whether rdtscp is there */
+    __cpuid(0x80000001, eax, ebx, ecx, edx);
+    return (edx & (1 << 27)) ? SRC_RDTSCP : SRC_TSC;
 }
 
-/* Return the number of cycles since the last call to start_counter. */
-double get_counter()
+static unsigned long long read_counter(void)
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
+    unsigned hi, lo;
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
+    access_counter(&hi, &lo);
+    return ((unsigned long long)hi << 32) | lo;
+}
 
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-	fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
-    }
-    return result;
+static unsigned long long read_ticks(void)
+{
+    unsigned hi, lo;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
 }
-/* $end x86cyclecounter */
 
-#elif defined(__alpha)
+#elif defined(__aarch64__)
+/*******************************************************
+ * ARM64 versions 
+ *
+ * The generic timer's virtual count register is always 
+ * constant-rate and its frequency is published in 
+ * CNTFRQ_EL0, so no calibration is needed. The isb keeps
+ * the read from being hoisted above the timed code.
+ *******************************************************/
+
+static int probe_counter(double *rate)
+{
+    unsigned long long freq;
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r" (freq));
+    *rate = freq / 1e6;
+    return (freq > 0) ? SRC_CNTVCT : SRC_CLOCK;
+}
+
+static unsigned long long read_counter(void)
+{
+    unsigned long long val;
+
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r" (val) : : "memory");
+    return val;
+}
+
+static unsigned long long read_ticks(void)
+{
+    unsigned long long val;
+
+    asm volatile("mrs %0, cntvct_el0" : "=r" (val));
+    return val;
+}
+
+#else
+/****************************************************************
+ * All the other platforms for which we haven't implemented cycle
+ * counter routines use the clock_gettime() fallback. Newer models
+ * of sparcs (v8plus) have cycle counters that can be accessed from
+ * user programs, but since there are still many sparc boxes out 
+ * there that don't support this, we haven't provided a Sparc 
+ * version here.
+ ***************************************************************/
+
+static int probe_counter(double *rate)
+{
+    *rate = 0.0;
+    return SRC_CLOCK;
+}
+
+static unsigned long long read_counter(void)
+{
+    return read_clock();
+}
+
+static unsigned long long read_ticks(void)
+{
+    return read_clock();
+}
+#endif
+
+/*
+ * init_counter - Pick the counter source on first use
+ */
+static void init_counter(void)
+{
+    double rate;
+
+    counter_src = probe_counter(&rate);
+    if (counter_src == SRC_CLOCK)
+	counter_mhz = 1000.0;
+    else if (rate > 0)
+	counter_mhz = rate;
+}
 
+/*
+ * counter_now - serialized read of whichever source was picked
+ */
+static unsigned long long counter_now(void)
+{
+    if (counter_src == SRC_UNKNOWN)
+	init_counter();
+    return (counter_src == SRC_CLOCK) ? read_clock() : read_counter();
+}
+
+#if defined(__alpha)
 /****************************************************
  * Alpha versions of start_counter() and get_counter()
  ***************************************************/
@@ -134,34 +268,54 @@ double get_counter()
 }
 
 #else
+/*******************************************************
+ * Versions of start_counter() and get_counter() for 
+ * everything but the Alpha, built on counter_now()
+ *******************************************************/
 
-/****************************************************************
- * All the other platforms for which we haven't implemented cycle
- * counter routines. Newer models of sparcs (v8plus) have cycle
- * counters that can be accessed from user programs, but since there
- * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
- ***************************************************************/
+static unsigned long long cyc_start = 0;
 
+/* Record the current value of the cycle counter. */
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    cyc_start = counter_now();
 }
 
-double get_counter() 
+/* Return the number of cycles since the last call to start_counter. */
+double get_counter()
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(counter_now() - cyc_start);
 }
 #endif
 
+/*******************************************************
+ * get_ticks - Read a raw, free-running timestamp counter.
+ * It is much cheaper than start_counter()/get_counter()
+ * because it does not serialize, and is meant for timing
+ * individual allocator requests. Its unit is the same as
+ * that of get_counter(), so mhz() converts it to time.
+ *******************************************************/
+unsigned long long get_ticks(void)
+{
+    if (counter_src == SRC_UNKNOWN)
+	init_counter();
+    return (counter_src == SRC_CLOCK) ? read_clock() : read_ticks();
+}
 
-
+/*
+ * counter_name - Describe the source behind the counter routines
+ */
+const char *counter_name(void)
+{
+    if (counter_src == SRC_UNKNOWN)
+	init_counter();
+    switch (counter_src) {
+    case SRC_TSC:    return "invariant TSC (lfence; rdtsc)";
+    case SRC_RDTSCP: return "invariant TSC (rdtscp)";
+    case SRC_CNTVCT: return "ARM64 generic timer (cntvct_el0)";
+    default:         return "clock_gettime(CLOCK_MONOTONIC_RAW)";
+    }
+}
 
 /*******************************
  * Machine-independent functions
@@ -179,31 +333,77 @@ double ovhd()
     return result;
 }
 
+/*
+ * calibrate - Measure the counter rate in MHz against the raw monotonic
+ *     clock over a busy-wait of nsecs nanoseconds. Busy-waiting rather
+ *     than sleeping keeps the core out of deep C-states while we look.
+ */
+static double calibrate(unsigned long long nsecs)
+{
+    unsigned long long t0, t1, c0, c1;
+
+    t0 = read_clock();
+    c0 = counter_now();
+    do {
+	t1 = read_clock();
+    } while (t1 - t0 < nsecs);
+    c1 = counter_now();
+    return (double)(c1 - c0) * 1e3 / (double)(t1 - t0);
+}
+
 /* $begin mhz */
-/* Estimate the clock rate by measuring the cycles that elapse */ 
-/* while sleeping for sleeptime seconds */
+/* Estimate the counter rate by measuring the cycles that elapse */ 
+/* during sleeptime seconds of the raw monotonic clock. Counters whose */
+/* rate is known (the clock_gettime fallback and ARM64) are not measured. */
 double mhz_full(int verbose, int sleeptime)
 {
     double rate;
 
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
+    if (counter_src == SRC_UNKNOWN)
+	init_counter();
+    rate = (counter_mhz > 0) ? counter_mhz : 
+	calibrate(1000000000ULL * sleeptime);
     if (verbose) 
-	printf("Processor clock rate ~= %.1f MHz\n", rate);
+	printf("Counter rate ~= %.1f MHz, using %s\n", rate, counter_name());
     return rate;
 }
 /* $end mhz */
 
-/* Version using a default sleeptime */
+/* 
+ * Default version: the median of CALIB_RUNS short calibrations, which
+ * is computed once and then cached 
+ */
+#define CALIB_RUNS 5
+#define CALIB_NSECS 10000000ULL  /* 10 ms per calibration */
+
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    double runs[CALIB_RUNS], tmp;
+    int i, j;
+
+    if (counter_src == SRC_UNKNOWN)
+	init_counter();
+    if (counter_mhz == 0.0) {
+	for (i = 0; i < CALIB_RUNS; i++) {
+	    runs[i] = calibrate(CALIB_NSECS);
+	    for (j = i; j > 0 && runs[j-1] > runs[j]; j--) {
+		tmp = runs[j-1];
+		runs[j-1] = runs[j];
+		runs[j] = tmp;
+	    }
+	}
+	counter_mhz = runs[CALIB_RUNS/2];
+    }
+    if (verbose) 
+	printf("Counter rate ~= %.1f MHz, using %s\n", 
+	       counter_mhz, counter_name());
+    return counter_mhz;
 }
 
 /** Special counters that compensate for timer interrupt overhead */
 
 static double cyc_per_tick = 0.0;
+static int callibrated = 0; /* callibrate() may find no interrupt to record */
 
 #define NEVENT 100
 #define THRESHOLD 1000
@@ -253,8 +453,10 @@ void start_comp_counter()
 {
     struct tms t;
 
-    if (cyc_per_tick == 0.0)
+    if (!callibrated) {
 	callibrate(0);
+	callibrated = 1;
+    }
     times(&t);
     start_tick = t.tms_utime;
     start_counter();
@@ -270,6 +472,8 @@ double get_comp_counter()
     times(&t);
     ticks = t.tms_utime - start_tick;
     ctime = time - ticks*cyc_per_tick;
+    if (ctime < 0) /* a tick estimate skewed by other load; don't trust it */
+	ctime = time;
     /*
       printf("Measured %.0f cycles.  Ticks = %d.  Corrected %.0f cycles\n",
       time, (int) ticks, ctime);
@@ -9,12 +9,18 @@ double get_counter();
 /* Measure overhead for counter */
 double ovhd();
 
-/* Determine clock rate of processor (using a default sleeptime) */
+/* Determine the counter rate in MHz (calibrated once, then cached) */
 double mhz(int verbose);
 
-/* Determine clock rate of processor, having more control over accuracy */
+/* Determine the counter rate, calibrating over sleeptime seconds */
 double mhz_full(int verbose, int sleeptime);
 
+/* Read a cheap raw timestamp counter, in the same unit as get_counter() */
+unsigned long long get_ticks(void);
+
+/* Describe the hardware counter or clock behind these routines */
+const char *counter_name(void);
+
 /** Special counters that compensate for timer interrupt overhead */
 
 void start_comp_counter();
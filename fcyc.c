@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -113,6 +114,8 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* a fresh buffer is all the kernel's zero page until written */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -2,6 +2,9 @@
  * High-level timing wrappers
  ****************************/
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "fsecs.h"
 #include "fcyc.h"
 #include "clock.h"
@@ -10,6 +13,19 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+#define FTIMER_RUNS 10          /* runs the ftimer backends average */
+#define FCYC_CACHE_BYTES (1<<19) /* what init_fsecs has fcyc clear ... */
+#define FCYC_CACHE_BLOCK 32     /* ... and its stride */
+#define LLC_DEFAULT (8<<20)     /* LLC size if it can't be found out */
+
+static int cache_mode = FSECS_DEFAULT;
+static size_t llc;              /* detected last-level cache size */
+static int line = 64;           /* cache line size */
+#if !USE_FCYC
+static char *flush_buf = NULL;  /* 2 * llc bytes, read to flush the caches */
+static volatile int sink = 0;
+#endif
+
 extern int verbose; /* -v option in mdriver.c */
 
 /*
@@ -40,17 +56,133 @@ void init_fsecs(void)
 }
 
 /*
- * fsecs - Return the running time of a function f (in seconds)
+ * fsecs_llc_bytes - Return the size of the CPU's last-level cache: the
+ *     highest level sysfs lists for cpu0, else what sysconf says, else
+ *     LLC_DEFAULT
+ */
+size_t fsecs_llc_bytes(void)
+{
+    char path[64];
+    FILE *fp;
+    int i, level, best = 0;
+    unsigned long size;
+    char unit;
+    long n;
+
+    if (llc > 0)
+	return llc;
+    for (i = 0; i < 16; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%d", &level) != 1)
+	    level = 0;
+	fclose(fp);
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	if (fscanf(fp, "%lu%c", &size, &unit) == 2 && level >= best) {
+	    best = level;
+	    llc = size << (unit == 'M' ? 20 : unit == 'K' ? 10 : 0);
+	}
+	fclose(fp);
+    }
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if (llc == 0 && (n = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0)
+	llc = n;
+    if (llc == 0 && (n = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+	llc = n;
+    if ((n = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0)
+	line = n;
+#else
+    (void)n;
+#endif
+    if (llc == 0)
+	llc = LLC_DEFAULT;
+    return llc;
+}
+
+#if !USE_FCYC
+/*
+ * flush_caches - Read a buffer twice the size of the LLC, so that
+ *     nothing the last run touched is left in any cache
+ */
+static void flush_caches(void)
+{
+    size_t i;
+    int x = sink;
+
+    for (i = 0; i < 2 * llc; i += line)
+	x += flush_buf[i];
+    sink = x;
+}
+
+/*
+ * ftimer - Time n runs of f with the configured interval timer
+ */
+static double ftimer(fsecs_test_funct f, void *argp, int n)
+{
+#if USE_ITIMER
+    return ftimer_itimer(f, argp, n);
+#else
+    return ftimer_gettod(f, argp, n);
+#endif
+}
+#endif
+
+/*
+ * set_fsecs_cache - Choose the cache state each timed run starts from,
+ *     FSECS_WARM, FSECS_COLD or FSECS_DEFAULT
+ */
+void set_fsecs_cache(int mode)
+{
+    if (mode == FSECS_COLD)
+	fsecs_llc_bytes();
+#if USE_FCYC
+    /* fcyc clears the cache itself, by reading a buffer of its own */
+    set_fcyc_clear_cache(mode != FSECS_WARM);
+    set_fcyc_cache_size(mode == FSECS_COLD ? 2 * llc : FCYC_CACHE_BYTES);
+    set_fcyc_cache_block(mode == FSECS_COLD ? line : FCYC_CACHE_BLOCK);
+#else
+    if (mode == FSECS_COLD && flush_buf == NULL) {
+	if ((flush_buf = malloc(2 * llc)) == NULL) {
+	    fprintf(stderr, "Fatal error.  Malloc returned null in set_fsecs_cache\n");
+	    exit(1);
+	}
+	memset(flush_buf, 1, 2 * llc); /* or all reads hit the zero page */
+    }
+#endif
+    cache_mode = mode;
+}
+
+/*
+ * fsecs - Return the running time of a function f (in seconds). Warm
+ *     runs follow an untimed one; cold runs each follow a cache flush,
+ *     which the ftimer backends then have to time one run at a time.
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
 #if USE_FCYC
-    double cycles = fcyc(f, argp);
+    double cycles;
+
+    if (cache_mode == FSECS_WARM)
+	f(argp);
+    cycles = fcyc(f, argp);
     return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
+#else
+    double secs = 0;
+    int i;
+
+    if (cache_mode == FSECS_COLD) {
+	for (i = 0; i < FTIMER_RUNS; i++) {
+	    flush_caches();
+	    secs += ftimer(f, argp, 1);
+	}
+	return secs / FTIMER_RUNS;
+    }
+    if (cache_mode == FSECS_WARM)
+	f(argp);
+    return ftimer(f, argp, FTIMER_RUNS);
 #endif 
 }
 
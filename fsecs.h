@@ -1,4 +1,13 @@
+#include <stddef.h>
+
 typedef void (*fsecs_test_funct)(void *);
 
+/* Cache state each timed run of fsecs starts from */
+#define FSECS_DEFAULT 0  /* whatever the timer backend does on its own */
+#define FSECS_WARM    1  /* caches hold what the previous run left */
+#define FSECS_COLD    2  /* caches flushed with twice the LLC's size */
+
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+void set_fsecs_cache(int mode);
+size_t fsecs_llc_bytes(void);
@@ -0,0 +1,115 @@
+/*
+ * heapstat.c - Analyze the shape of the mm heap during a replay
+ *
+ * heap_sample walks the implicit block chain and the segregated free
+ * lists of mm.c through mm_walk_heap and mm_walk_free and splits the
+ * heap into its parts:
+ *
+ *   heap = payload + padding + overhead + free bytes + other
+ *
+ * where padding is the alignment and minimum-size slack inside the
+ * allocated blocks, overhead their headers and footers, and other the
+ * prologue, epilogue and alignment words outside any block. From those
+ * it derives
+ *
+ *   internal fragmentation = (padding + overhead) / allocated bytes
+ *   external fragmentation = 1 - largest free block / free bytes
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "heapstat.h"
+#include "memlib.h"
+#include "mm.h"
+
+/* 
+ * visit_block - mm_walk_heap callback that tallies one block 
+ */
+static void visit_block(void *bp, size_t size, size_t overhead, int alloc, 
+			void *arg)
+{
+    heap_sample_t *s = (heap_sample_t *)arg;
+
+    if (alloc) {
+	s->alloc_blocks++;
+	s->alloc_bytes += size;
+	s->overhead += overhead;
+    }
+    else {
+	s->free_blocks++;
+	s->free_bytes += size;
+	if (size > s->largest_free)
+	    s->largest_free = size;
+    }
+}
+
+/* 
+ * visit_free - mm_walk_free callback that tallies one listed block 
+ */
+static void visit_free(int bucket, void *bp, size_t size, void *arg)
+{
+    heap_sample_t *s = (heap_sample_t *)arg;
+
+    s->listed_blocks++;
+    if (bucket < HEAP_MAX_BUCKETS)
+	s->bucket_blocks[bucket]++;
+}
+
+/* 
+ * heap_sample - Walk the mm heap and its free lists 
+ */
+void heap_sample(heap_sample_t *s, int opnum, size_t payload)
+{
+    memset(s, 0, sizeof(heap_sample_t));
+    s->opnum = opnum;
+    s->heap = mem_heapsize();
+    s->payload = payload;
+    s->nbuckets = mm_num_buckets();
+    if (s->nbuckets > HEAP_MAX_BUCKETS)
+	s->nbuckets = HEAP_MAX_BUCKETS;
+    mm_walk_heap(visit_block, s);
+    mm_walk_free(visit_free, s);
+}
+
+/* 
+ * heap_print_header - Print the column headers of a time series 
+ */
+void heap_print_header(FILE *fp)
+{
+    fprintf(fp, "%7s%10s%10s%6s%8s%8s%8s%8s%7s%9s%8s  %s\n",
+	    "op", "heap", "payload", "util", "intfrag", "hdr/ftr", "pad",
+	    "extfrag", "nfree", "largest", "lg/tot", "free blocks per bucket");
+}
+
+/* 
+ * heap_print_sample - Print one row of a time series. Percentages of 
+ *     internal fragmentation are of the allocated bytes, and a "!" 
+ *     flags free lists that disagree with the block chain.
+ */
+void heap_print_sample(FILE *fp, heap_sample_t *s)
+{
+    int i;
+    size_t padding = s->alloc_bytes - s->overhead - s->payload;
+    double alloc = s->alloc_bytes ? (double)s->alloc_bytes : 1.0;
+    double ratio = s->free_bytes ? 
+	(double)s->largest_free / s->free_bytes : 1.0;
+
+    fprintf(fp, "%7d%10lu%10lu%5.0f%%%7.1f%%%7.1f%%%7.1f%%%7.1f%%%7lu%9lu%8.2f ",
+	    s->opnum,
+	    (unsigned long)s->heap,
+	    (unsigned long)s->payload,
+	    s->heap ? 100.0 * s->payload / s->heap : 0.0,
+	    100.0 * (padding + s->overhead) / alloc,
+	    100.0 * s->overhead / alloc,
+	    100.0 * padding / alloc,
+	    100.0 * (1.0 - ratio),
+	    (unsigned long)s->free_blocks,
+	    (unsigned long)s->largest_free,
+	    ratio);
+    if (s->listed_blocks != s->free_blocks)
+	fprintf(fp, "!");
+    for (i = 0; i < s->nbuckets; i++)
+	if (s->bucket_blocks[i])
+	    fprintf(fp, " %d:%lu", i, (unsigned long)s->bucket_blocks[i]);
+    fprintf(fp, "\n");
+}
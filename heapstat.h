@@ -0,0 +1,36 @@
+/*
+ * heapstat.h - prototypes for the heap shape analyzer in heapstat.c
+ */
+#ifndef __HEAPSTAT_H_
+#define __HEAPSTAT_H_
+
+#include <stdio.h>
+
+#define HEAP_MAX_BUCKETS 64  /* most free list buckets we can report */
+
+/* A snapshot of the shape of the mm heap at one point of a replay */
+typedef struct {
+    int opnum;            /* trace request after which it was taken */
+    size_t heap;          /* current heap size (mem_heapsize) */
+    size_t payload;       /* bytes requested by the live blocks */
+    size_t alloc_blocks;  /* number of allocated blocks ... */
+    size_t alloc_bytes;   /* ... and their total size */
+    size_t overhead;      /* header and footer bytes of allocated blocks */
+    size_t free_blocks;   /* number of free blocks in the block chain ... */
+    size_t free_bytes;    /* ... and their total size */
+    size_t largest_free;  /* size of the largest free block */
+    size_t listed_blocks; /* number of blocks on the free lists */
+    int nbuckets;         /* number of free list buckets */
+    size_t bucket_blocks[HEAP_MAX_BUCKETS]; /* free blocks per bucket */
+} heap_sample_t;
+
+/* Walk the mm heap and its free lists and summarize their shape */
+void heap_sample(heap_sample_t *s, int opnum, size_t payload);
+
+/* Print the column headers of a time series of samples */
+void heap_print_header(FILE *fp);
+
+/* Print one sample as a row of the time series */
+void heap_print_sample(FILE *fp, heap_sample_t *s);
+
+#endif /* __HEAPSTAT_H_ */
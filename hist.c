@@ -0,0 +1,126 @@
+/*
+ * hist.c - Log-bucketed histograms for recording request latencies
+ *
+ * Bucket layout: values v < 2^S (S = HIST_SUB_BITS) each get their own
+ * bucket. Every larger power-of-two range [2^m, 2^(m+1)) is split into
+ * 2^(S-1) equally wide sub-buckets, so the bucket index of v is found
+ * with one bit scan and one shift, and hist_record never loops.
+ */
+#include <string.h>
+
+#include "hist.h"
+
+#define SUB_COUNT (1 << HIST_SUB_BITS)  /* values recorded exactly */
+#define HALF_COUNT (SUB_COUNT >> 1)     /* sub-buckets per power of 2 */
+
+/* 
+ * msb - index of the most significant set bit of v (v != 0) 
+ */
+static int msb(hist_val_t v)
+{
+    return 63 - __builtin_clzll(v);
+}
+
+/* 
+ * bucket_index - map a value to its bucket 
+ */
+static int bucket_index(hist_val_t v)
+{
+    int shift;
+
+    if (v < SUB_COUNT)
+	return (int)v;
+    shift = msb(v) - HIST_SUB_BITS + 1;
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + 
+	(int)((v >> shift) - HALF_COUNT);
+}
+
+/* 
+ * bucket_top - the largest value that maps to bucket idx 
+ */
+static hist_val_t bucket_top(int idx)
+{
+    int shift;
+    hist_val_t sub;
+
+    if (idx < SUB_COUNT)
+	return (hist_val_t)idx;
+    shift = (idx - SUB_COUNT) / HALF_COUNT + 1;
+    sub = (idx - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+/* 
+ * hist_init - Reset a histogram to hold no samples
+ */
+void hist_init(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/* 
+ * hist_record - Record one sample
+ */
+void hist_record(hist_t *h, hist_val_t val)
+{
+    if (h->count == 0 || val < h->min)
+	h->min = val;
+    if (val > h->max)
+	h->max = val;
+    h->count++;
+    h->total += (double)val;
+    h->buckets[bucket_index(val)]++;
+}
+
+/* 
+ * hist_merge - Add all samples of src to dst
+ */
+void hist_merge(hist_t *dst, hist_t *src)
+{
+    int i;
+
+    if (src->count == 0)
+	return;
+    if (dst->count == 0 || src->min < dst->min)
+	dst->min = src->min;
+    if (src->max > dst->max)
+	dst->max = src->max;
+    dst->count += src->count;
+    dst->total += src->total;
+    for (i = 0; i < HIST_BUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+}
+
+/* 
+ * hist_percentile - Return the value at quantile q, rounded up to the 
+ *     top of its bucket but never above the largest recorded sample
+ */
+hist_val_t hist_percentile(hist_t *h, double q)
+{
+    int i;
+    hist_val_t rank, seen = 0, top;
+
+    if (h->count == 0)
+	return 0;
+    rank = (hist_val_t)(q * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    if (rank > h->count)
+	rank = h->count;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen >= rank) {
+	    top = bucket_top(i);
+	    return (top < h->max) ? top : h->max;
+	}
+    }
+    return h->max;
+}
+
+/* 
+ * hist_mean - Return the mean of the recorded samples
+ */
+double hist_mean(hist_t *h)
+{
+    return (h->count > 0) ? h->total / h->count : 0.0;
+}
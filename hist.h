@@ -0,0 +1,45 @@
+/*
+ * hist.h - prototypes for the log-bucketed latency histograms in hist.c
+ *
+ * A histogram records non-negative integer samples (e.g. timer ticks)
+ * into buckets whose width grows with the magnitude of the value, in
+ * the style of HDR histograms. Values below 2^HIST_SUB_BITS are
+ * recorded exactly; larger values are recorded with a relative error
+ * of at most 2^-(HIST_SUB_BITS-1), about 6% for the default.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+#define HIST_SUB_BITS 5 /* log2 of the number of sub-buckets per power of 2 */
+#define HIST_BUCKETS  ((1 << HIST_SUB_BITS) + \
+		       (64 - HIST_SUB_BITS) * (1 << (HIST_SUB_BITS - 1)))
+
+typedef unsigned long long hist_val_t;
+
+typedef struct {
+    hist_val_t count;                 /* number of recorded samples */
+    hist_val_t min;                   /* smallest sample seen */
+    hist_val_t max;                   /* largest sample seen */
+    double total;                     /* sum of all samples */
+    hist_val_t buckets[HIST_BUCKETS]; /* number of samples per bucket */
+} hist_t;
+
+/* Reset a histogram to hold no samples */
+void hist_init(hist_t *h);
+
+/* Record one sample */
+void hist_record(hist_t *h, hist_val_t val);
+
+/* Add all samples of src to dst */
+void hist_merge(hist_t *dst, hist_t *src);
+
+/* 
+ * Return the smallest value v such that a fraction q (0 <= q <= 1) of 
+ * the samples are <= v, rounded up to the top of v's bucket 
+ */
+hist_val_t hist_percentile(hist_t *h, double q);
+
+/* Return the mean of the recorded samples */
+double hist_mean(hist_t *h);
+
+#endif /* __HIST_H_ */
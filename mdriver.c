@@ -13,13 +13,27 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 
 #include "mm.h"
+#include "mm_inline.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "hist.h"
+#include "bench.h"
+#include "perfctr.h"
+#include "heapstat.h"
+#include "bintrace.h"
 #include "config.h"
 
 /**********************
@@ -30,6 +44,28 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define BINTRACE_CHUNK 65536 /* binary trace records read at a time */
+
+/* Multi-threaded replay (-P) */
+#define THREAD_REPS    10 /* passes each thread makes over its copy */
+#define LAT_SAMPLE     16 /* time one out of every LAT_SAMPLE requests */
+
+/* Multi-process replay on a shared heap (-M) */
+#define MP_MAGIC 0x6d706d64 /* marks a child's result block */
+
+/* False-sharing benchmark (-F) */
+#define FS_INCS  20000000 /* increments each thread makes to its counter */
+
+/* Payload-touching replay (-x) */
+#define TOUCH_WRITE  0x1  /* write each payload byte once, when allocated */
+#define TOUCH_READ   0x2  /* read a payload back before freeing it */
+#define TOUCH_SCAN   0x4  /* every so many requests, read every live block */
+#define TOUCH_SCAN_OPS 1000 /* default requests between scans */
+#define TOUCH_LINE     64 /* a scan reads one byte per line this long */
+
+/* Per-request latency histograms (-H) */
+#define LAT_CLASSES    16 /* request size classes: <=16, <=32, ... bytes */
+#define LAT_OUTLIERS   10 /* number of slowest requests reported */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
@@ -47,9 +83,9 @@ typedef struct range_t {
 
 /* Characterizes a single trace operation (allocator request) */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    enum {ALLOC, FREE, REALLOC, CALLOC} type; /* type of request */
     int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
+    int size;                         /* byte size of alloc/realloc/calloc request */
 } traceop_t;
 
 /* Holds the information for one trace file*/
@@ -82,15 +118,166 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    double heap;     /* heap size high-water mark in bytes */
+    double payload;  /* peak total payload in bytes */
+    double kops;     /* throughput in thousands of ops per sec */
+    double lat[3][3];/* p50/p99/p99.9 latency in ns by request type */
+    double warm_secs;/* secs with the caches warm ... */
+    double cold_secs;/* ... and flushed before each run (-T) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* 
+ * Describes one per-trace metric for the structured output (-o) and
+ * for the regression check against a baseline (-b)
+ */
+typedef struct {
+    char *name;      /* CSV column or JSON key */
+    size_t offset;   /* where the metric lives in a stats_t */
+    int better;      /* +1 if higher is better, -1 if lower, 0 neither */
+    double tol;      /* default tolerance written by -W, 0 if none */
+} metric_t;
+
+/* Per-thread state for the multi-threaded replay engine */
+typedef struct {
+    trace_t *trace;            /* trace shared (read-only) by all threads */
+    char **blocks;             /* this thread's private block pointers */
+    int libc;                  /* replay libc malloc instead of mm? */
+    memlib_t *mem;             /* this thread's own modeled VM ... */
+    mm_heap_t *heap;           /* ... and the mm heap built on it */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    double *lat;               /* sampled per-request latencies (secs) */
+    int nlat;                  /* number of latency samples taken */
+    double t_start, t_end;     /* when this thread left the barrier, and
+				  when it finished its last pass */
+    int failed;                /* did some request return NULL? */
+} thread_arg_t;
+
+/* Summarizes one multi-process replay of a trace on a shared heap */
+typedef struct {
+    int nprocs;      /* number of processes, each replaying its own copy */
+    int valid;       /* did every copy run, and the shared heap check out? */
+    double ops;      /* total number of ops across all processes */
+    double secs;     /* wall time from start until the last process is done */
+    size_t heapsize; /* size the shared heap grew to */
+} mpstats_t;
+
+/* What the processes of a multi-process replay share besides the heap */
+typedef struct {
+    pthread_barrier_t start;   /* released once every process is ready */
+    struct {
+	size_t result;         /* heap offset of the block it leaves for
+				  the parent */
+	double start, end;     /* when it left the barrier, and when it
+				  finished its last pass */
+    } proc[1];                 /* per process (nprocs of them) */
+} mpctl_t;
+
+/* A child's result block, read by the parent straight from the heap */
+typedef struct {
+    int magic;                 /* MP_MAGIC */
+    int id;                    /* which child wrote it */
+    double ops;                /* requests it made */
+} mpresult_t;
+
+/* Params to eval_touch_speed, which is timed by fsecs like the xx_speed
+   routines, but stands in for an application using the memory */
+typedef struct {
+    trace_t *trace;
+    int libc;                  /* libc malloc instead of mm? */
+    int modes;                 /* TOUCH_* */
+    int scan;                  /* requests between scans */
+    unsigned long sum;         /* what the reads added up to */
+} touch_t;
+
+/* What a payload-touching replay took, for one malloc package (-x) */
+typedef struct {
+    int valid;                 /* was the package's own replay valid? */
+    double secs;               /* time to run the trace and the touching */
+    perf_counts_t events;      /* hardware events during one run */
+} touchstats_t;
+
+/* A replay of a trace through movable handles, with compaction (-A) */
+typedef struct {
+    int valid;                 /* did every request succeed, every block
+				  keep its contents, and the heap check out? */
+    double ops;                /* number of requests ... */
+    double secs;               /* ... and their wall time */
+    double util;               /* peak live payload / peak heap size */
+    size_t peak_heap;          /* largest the heap got ... */
+    size_t final_heap;         /* ... and its size after a last compaction */
+    mm_compact_stats_t compact; /* what compaction did */
+} hstats_t;
+
+/* A replay of a trace with the sampling profiler on (-p) */
+typedef struct {
+    int valid;                 /* did the replay succeed, and end with the
+				  heap consistent and no sample left live? */
+    double ops;                /* number of requests ... */
+    double secs;               /* ... and the time to run them, sampled */
+    mm_profile_stats_t peak;   /* the profile at the trace's live peak ... */
+    mm_profile_stats_t end;    /* ... and at its end */
+    char path[32];             /* where the profile at the peak went */
+} profstats_t;
+
+/* What decay purging did during and after one replay of a trace (-d) */
+typedef struct {
+    double secs;               /* wall time of the replay */
+    mm_decay_stats_t run;      /* purging as of the end of the replay ... */
+    mm_decay_stats_t idle;     /* ... and once the heap sat idle a window */
+} decaystats_t;
+
+/* Snapshot of the mm heap halfway through a trace, and its restores (-R) */
+typedef struct {
+    int valid;                 /* did both restored heaps check out? */
+    size_t heapsize;           /* bytes in the snapshot's heap */
+    double build;              /* secs to replay the first half */
+    double save;               /* secs to write the snapshot */
+    double restore;            /* secs to map it back in over the heap ... */
+    double finish;             /* ... and to then replay the second half */
+    double reloc;              /* secs to restore it into a new memlib */
+    int moved;                 /* did that one land at another base? */
+} snapstats_t;
+
+/* Per-thread state for the false-sharing benchmark */
+typedef struct {
+    volatile long *counter;    /* this thread's own counter, in the mm heap */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+} fs_arg_t;
+
+/* 
+ * Latency histograms for one replay of a trace, by request type 
+ * (indexed by the traceop_t type) and size class, together with the
+ * slowest requests seen, sorted from slowest down
+ */
+typedef struct {
+    hist_t hists[3][LAT_CLASSES];
+    struct {
+	int opnum;         /* request number in the trace */
+	hist_val_t ticks;  /* time it took */
+    } slowest[LAT_OUTLIERS];
+    int nslowest;
+} latency_t;
+
+/* Summarizes one multi-threaded replay of a trace */
+typedef struct {
+    int nthreads;    /* number of threads, each replaying its own copy */
+    int valid;       /* did every thread run its copy to completion? */
+    double ops;      /* total number of ops across all threads */
+    double secs;     /* wall time from start until the last thread is done */
+    double p50;      /* sampled request latency percentiles (secs) */
+    double p99;
+    double p999;
+} mtstats_t;
+
 /********************
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int release_heap = 0; /* give the heap back to the OS between runs (-Z) */
+static int cache_modes = 0;  /* also time with warm and cold caches (-T) */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -101,6 +288,29 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The metrics exported by -o and checked by -b */
+#define METRIC(field, name, better, tol) \
+    {name, offsetof(stats_t, field), better, tol}
+static metric_t metrics[] = {
+    METRIC(util,      "util",               +1, 0.01),
+    METRIC(ops,       "ops",                 0, 0),
+    METRIC(secs,      "secs",               -1, 0),
+    METRIC(kops,      "kops",               +1, 0.25),
+    METRIC(heap,      "heap_bytes",         -1, 0.02),
+    METRIC(payload,   "peak_payload_bytes",  0, 0),
+    METRIC(lat[0][0], "malloc_p50_ns",      -1, 0),
+    METRIC(lat[0][1], "malloc_p99_ns",      -1, 0.50),
+    METRIC(lat[0][2], "malloc_p999_ns",     -1, 0),
+    METRIC(lat[1][0], "free_p50_ns",        -1, 0),
+    METRIC(lat[1][1], "free_p99_ns",        -1, 0.50),
+    METRIC(lat[1][2], "free_p999_ns",       -1, 0),
+    METRIC(lat[2][0], "realloc_p50_ns",     -1, 0),
+    METRIC(lat[2][1], "realloc_p99_ns",     -1, 0.50),
+    METRIC(lat[2][2], "realloc_p999_ns",    -1, 0),
+};
+#define NUM_METRICS (sizeof(metrics) / sizeof(metric_t))
+#define METRIC_VAL(s, m) (*(double *)((char *)(s) + (m)->offset))
+
 
 /********************* 
  * Function prototypes 
@@ -114,17 +324,98 @@ static void clear_ranges(range_t **ranges);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int read_bintrace(FILE *tracefile, trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
+static void eval_cache_modes(fsecs_test_funct f, speed_t *speed_params, 
+			     stats_t *stats);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_shape(trace_t *trace, int tracenum, int interval);
+static void eval_mm_trace(char *tracefile, int tracenum, int check_mode,
+			  bench_params_t *bench_params, stats_t *stats,
+			  bench_result_t *bench_result, perf_counts_t *events);
+static void eval_mm_parallel(int njobs, int pin_cpu, char **tracefiles, 
+			     int n, int check_mode, bench_params_t *bench_params,
+			     stats_t *stats, bench_result_t *bench_results);
+static int recv_mm_results(int fd, stats_t *stats, bench_result_t *result);
+
+/* Routines for the multi-threaded replay of either malloc package */
+static mtstats_t eval_mt_speed(trace_t *trace, int nthreads, int libc);
+static void *mt_replay(void *ptr);
+static void print_mt_results(char *name, int ntraces, int ncounts,
+			     mtstats_t *stats);
+
+/* Routines for the multi-process replay on a shared mm heap */
+static mpstats_t eval_mp_speed(trace_t *trace, int nprocs);
+static int mp_replay(trace_t *trace, memlib_t *mem, mm_heap_t *heap, 
+		     mpctl_t *ctl, int id);
+static void print_mp_results(int ntraces, int ncounts, mpstats_t *stats);
+
+/* Routines for the payload-touching replay */
+static int parse_touch(char *arg, int *scan);
+static void eval_touch_speed(void *ptr);
+static void print_touch_results(int modes, int scan, int ntraces, 
+				stats_t *mm_stats, touchstats_t *mm_touch,
+				stats_t *libc_stats, touchstats_t *libc_touch);
+
+/* Routines for the replay through movable handles */
+static void eval_mm_handles(trace_t *trace, hstats_t *stats);
+static void print_handle_results(int ntraces, hstats_t *stats, 
+				 stats_t *mm_stats);
+
+/* Routines for the sampling profiler */
+static void eval_mm_profile(trace_t *trace, int tracenum, size_t rate, 
+			    profstats_t *stats);
+static void print_profile_results(size_t rate, int ntraces, 
+				  profstats_t *stats, stats_t *mm_stats);
+
+/* Routines for reporting decay purging */
+static void eval_mm_decay(trace_t *trace, long ms, decaystats_t *stats);
+static void print_decay_results(long ms, int ntraces, decaystats_t *stats);
+
+/* Routines for timing heap snapshots */
+static int replay_mm(trace_t *trace, int lo, int hi);
+static void eval_mm_snapshot(trace_t *trace, char *path, snapstats_t *stats);
+static void print_snapshot_results(int ntraces, snapstats_t *stats);
+
+/* Routines for the false-sharing benchmark */
+static double eval_false_sharing(int nthreads, int flags, int *shared);
+static void *fs_count(void *ptr);
+
+/* Routines for timing every request of either malloc package */
+static void eval_latency(trace_t *trace, latency_t *lat, int libc);
+static void print_latency(char *name, int tracenum, trace_t *trace, 
+			  latency_t *lat);
+
+/* Routines for reporting and comparing benchmark harness results */
+static void print_bench_results(int n, stats_t *stats, 
+				bench_result_t *results);
+static void save_bench_results(char *file, int n, char **tracefiles,
+			       stats_t *stats, bench_result_t *results);
+static void compare_bench_results(char *file, int n, char **tracefiles,
+				  stats_t *stats, bench_result_t *results,
+				  double min_effect);
+
+/* Routine for reporting hardware event counts */
+static void print_events(char *name, int n, stats_t *stats, 
+			 perf_counts_t *counts);
+
+/* Routines for structured results and regression baselines */
+static void store_latency(stats_t *stats, latency_t *lat);
+static void write_results(char *file, int n, char **tracefiles, 
+			  stats_t *stats, double perfindex);
+static void write_baseline(char *file, int n, char **tracefiles, 
+			   stats_t *stats);
+static int check_baseline(char *file, int n, char **tracefiles, 
+			  stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
@@ -133,13 +424,18 @@ static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
+static double wall_secs(void);
+static int write_all(int fd, void *buf, size_t len);
+static int read_all(int fd, void *buf, size_t len);
+static char *trace_name(char *path);
+static int cmp_double(const void *a, const void *b);
 
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i;
+    int i, j;
     int c;
     int exit_code = 0;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
@@ -152,6 +448,45 @@ int main(int argc, char **argv)
 
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int max_threads = 0; /* If set, also replay on up to this many threads (-P) */
+    int fs_threads = 0;  /* If set, run the false-sharing benchmark (-F) */
+    int max_procs = 0;   /* If set, replay on up to this many processes (-M) */
+    int handles = 0;     /* If set, also replay through movable handles (-A) */
+    int touch = 0;       /* If set, TOUCH_* ways to use the payloads (-x) ... */
+    int touch_scan = TOUCH_SCAN_OPS;  /* ... and the requests between scans */
+    touch_t touch_params;             /* input parameters to eval_touch_speed */
+    touchstats_t *mm_touch = NULL;    /* per trace results for -x, for mm ... */
+    touchstats_t *libc_touch = NULL;  /* ... and for libc malloc */
+    hstats_t *h_stats = NULL;         /* per trace results for -A */
+    long prof_rate = 0;  /* If set, sample about every this many bytes (-p) */
+    profstats_t *prof_stats = NULL;   /* per trace results for -p */
+    mpstats_t *mp_stats = NULL;       /* per trace/process count results for -M */
+    long decay_ms = -1;  /* If set, purge free pages after this long (-d) */
+    decaystats_t *decay_stats = NULL; /* per trace results for -d */
+    char *snap_file = NULL; /* If set, time heap snapshots through this file (-R) */
+    snapstats_t *snap_stats = NULL;   /* per trace results for -R */
+    int thread_counts[32];     /* thread counts tried by the -P replay */
+    int num_counts = 0;        /* the number of entries in that array */
+    mtstats_t *mt_stats = NULL;/* per trace/thread count results for -P */
+    int latency = 0;     /* If set, time and histogram every request (-H) */
+    latency_t *lat = NULL;     /* request latencies for one trace */
+    int bench = 0;       /* If set, time mm with the benchmark harness (-B) */
+    int pin_cpu = -1;    /* If >= 0, pin the driver to this CPU (-C) */
+    char *save_file = NULL;    /* save benchmark samples to this file (-S) */
+    char *compare_file = NULL; /* compare benchmark samples to this file (-X) */
+    double min_effect = BENCH_MIN_EFFECT; /* smallest change -X reports (-E) */
+    bench_params_t bench_params;        /* benchmark harness settings */
+    bench_result_t *bench_results = NULL; /* benchmark samples per trace */
+    char *results_file = NULL; /* write JSON or CSV results here (-o) */
+    char *baseline_file = NULL;/* check for regressions against this (-b) */
+    char *new_baseline = NULL; /* write a fresh baseline here (-W) */
+    int count_events = 0;      /* If set, count hardware events (-e) */
+    perf_counts_t *mm_events = NULL;   /* mm event counts per trace */
+    perf_counts_t *libc_events = NULL; /* libc event counts per trace */
+    int shape_interval = 0;    /* If set, sample the heap shape this often (-a) */
+    int mm_counters = 0;       /* If set, print mm.c's statistics (-s) */
+    int check_mode = MM_CHECK_OFF; /* mm_check mode for the validity pass (-k) */
+    int jobs = 1;              /* evaluate this many traces at once (-j) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -160,7 +495,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVglc:")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVglc:P:HBC:S:X:E:o:b:W:ea:sk:m:j:ZF:d:R:M:Ap:x:T")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -173,6 +508,9 @@ int main(int argc, char **argv)
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+	case 's': /* Print the allocator's own statistics per trace */
+	    mm_counters = 1;
+	    break;
 	case 't': /* Directory where the traces are located */
 	    if (num_tracefiles == 1) /* ignore if -f already encountered */
 		break;
@@ -192,6 +530,107 @@ int main(int argc, char **argv)
         case 'c':
             exit_code = atoi(optarg);
             break;
+        case 'P': /* Replay N copies of each trace on up to N threads */
+            max_threads = atoi(optarg);
+            if (max_threads < 1)
+		app_error("-P needs a positive thread count");
+            break;
+        case 'd': /* Purge free pages that stay unused for ms milliseconds */
+            decay_ms = atol(optarg);
+            if (decay_ms < 0 || mm_set_decay(decay_ms) < 0)
+		app_error("-d needs a window between 0 and 86400000 ms");
+            break;
+        case 'R': /* Time saving and restoring heap snapshots */
+            snap_file = optarg;
+            break;
+        case 'F': /* Time counters that share a cache line, and don't */
+            fs_threads = atoi(optarg);
+            if (fs_threads < 2)
+		app_error("-F needs at least 2 threads");
+            break;
+        case 'A': /* Replay through movable handles, compacting the heap */
+            handles = 1;
+            break;
+        case 'T': /* Time with warm and with flushed caches too */
+            cache_modes = 1;
+            break;
+        case 'x': /* Replay again, using the payloads like an application */
+            if ((touch = parse_touch(optarg, &touch_scan)) <= 0)
+		app_error("-x needs some of w, r and s[<n>]");
+            break;
+        case 'p': /* Profile, sampling about one allocation per N bytes */
+            prof_rate = atol(optarg);
+            if (prof_rate < 1)
+		app_error("-p needs a positive byte count");
+            break;
+        case 'M': /* Replay N copies of each trace in N processes on one heap */
+            max_procs = atoi(optarg);
+            if (max_procs < 1)
+		app_error("-M needs a positive process count");
+            break;
+        case 'H': /* Histogram the latency of every request */
+            latency = 1;
+            break;
+        case 'a': /* Sample the shape of the mm heap every n requests */
+            shape_interval = atoi(optarg);
+            if (shape_interval < 1)
+		app_error("-a needs a positive number of requests");
+            break;
+        case 'k': /* Check the mm heap after every call while validating */
+            if (strcmp(optarg, "incr") == 0)
+		check_mode = MM_CHECK_INCR;
+            else if (strcmp(optarg, "full") == 0)
+		check_mode = MM_CHECK_FULL;
+            else
+		app_error("-k takes \"incr\" or \"full\"");
+            if (mm_set_check(check_mode) < 0)
+		app_error("-k needs mm.c built with \"make clean; make CHECK=1\"");
+            mm_set_check(MM_CHECK_OFF);
+            break;
+        case 'j': /* Evaluate traces concurrently in forked workers */
+            jobs = atoi(optarg);
+            if (jobs < 1)
+		app_error("-j needs a positive number of workers");
+            break;
+        case 'Z': /* Time each run on a heap fresh from the OS */
+            release_heap = 1;
+            break;
+        case 'm': /* Model a larger (or smaller) VM for big traces */
+            if (atol(optarg) < 1 || atol(optarg) > 2047)
+		app_error("-m needs a heap size between 1 and 2047 MB");
+            mem_set_max_heap((size_t)atol(optarg) << 20);
+            break;
+        case 'B': /* Time mm with the adaptive benchmark harness */
+            bench = 1;
+            break;
+        case 'C': /* Pin the driver to one CPU */
+            pin_cpu = atoi(optarg);
+            break;
+        case 'S': /* Save the benchmark samples for a later -X */
+            bench = 1;
+            save_file = optarg;
+            break;
+        case 'X': /* Compare the benchmark samples to those saved by -S */
+            bench = 1;
+            compare_file = optarg;
+            break;
+        case 'E': /* Smallest change, in percent, that -X reports */
+            if (atof(optarg) < 0)
+		app_error("-E needs a percentage of 0 or more");
+            min_effect = atof(optarg) / 100;
+            break;
+        case 'e': /* Count hardware events during the timed replays */
+            count_events = 1;
+            break;
+        case 'o': /* Write machine-readable results (JSON or .csv) */
+            results_file = optarg;
+            break;
+        case 'b': /* Fail if the results regress against a baseline */
+            baseline_file = optarg;
+            break;
+        case 'W': /* Write the results as a new baseline */
+            new_baseline = optarg;
+            break;
         case 'h': /* Print this message */
 	    usage();
             exit(0);
@@ -211,9 +650,33 @@ int main(int argc, char **argv)
 	printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    /* Workers can't share the driver's hardware event counters */
+    if (jobs > 1 && count_events) {
+	printf("Hardware event counting needs a serial run, ignoring -e\n");
+	count_events = 0;
+    }
+
+    /* Keep the scheduler from migrating us while we measure */
+    if (pin_cpu >= 0 && bench_pin_cpu(pin_cpu) < 0)
+	unix_error("Could not pin the driver to the CPU given by -C");
+
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Open the hardware event counters */
+    if (count_events) {
+	if (perf_open() == 0) {
+	    printf("No hardware event counters available, ignoring -e "
+		   "(see /proc/sys/kernel/perf_event_paranoid)\n");
+	    count_events = 0;
+	}
+	else if ((mm_events = (perf_counts_t *)calloc(num_tracefiles, 
+				sizeof(perf_counts_t))) == NULL ||
+		 (libc_events = (perf_counts_t *)calloc(num_tracefiles, 
+				sizeof(perf_counts_t))) == NULL)
+	    unix_error("perf_counts_t calloc in main failed");
+    }
+
     /*
      * Optionally run and evaluate the libc malloc package 
      */
@@ -238,6 +701,10 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		eval_cache_modes(eval_libc_speed, &speed_params, &libc_stats[i]);
+		if (count_events)
+		    perf_measure(eval_libc_speed, &speed_params, 
+				 &libc_events[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -260,27 +727,28 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
+    /* Allocate the benchmark results, with one per tracefile */
+    if (bench) {
+	bench_init_params(&bench_params);
+	bench_results = (bench_result_t *)calloc(num_tracefiles, 
+						 sizeof(bench_result_t));
+	if (bench_results == NULL)
+	    unix_error("bench_results calloc in main failed");
+    }
+
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
+    if (jobs > 1)
+	eval_mm_parallel(jobs, pin_cpu, tracefiles, num_tracefiles, check_mode,
+			 bench ? &bench_params : NULL, mm_stats, bench_results);
+    else {
+	for (i=0; i < num_tracefiles; i++)
+	    eval_mm_trace(tracefiles[i], i, check_mode, 
+			  bench ? &bench_params : NULL, &mm_stats[i], 
+			  bench ? &bench_results[i] : NULL,
+			  count_events ? &mm_events[i] : NULL);
     }
 
     /* Display the mm results in a compact table */
@@ -290,6 +758,287 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    /* Display the hardware event counts next to the libc ones */
+    if (count_events) {
+	print_events("mm malloc", num_tracefiles, mm_stats, mm_events);
+	if (run_libc)
+	    print_events("libc malloc", num_tracefiles, libc_stats, 
+			 libc_events);
+	printf("\n");
+	perf_close();
+	free(mm_events);
+	free(libc_events);
+    }
+
+    /* 
+     * Report the benchmark statistics, and optionally save them or test 
+     * them for significant differences from an earlier run 
+     */
+    if (bench) {
+	print_bench_results(num_tracefiles, mm_stats, bench_results);
+	if (save_file)
+	    save_bench_results(save_file, num_tracefiles, tracefiles, 
+			       mm_stats, bench_results);
+	if (compare_file)
+	    compare_bench_results(compare_file, num_tracefiles, tracefiles,
+				  mm_stats, bench_results, min_effect);
+	for (i=0; i < num_tracefiles; i++)
+	    bench_free(&bench_results[i]);
+	free(bench_results);
+	printf("\n");
+    }
+
+    /* 
+     * Optionally print the statistics mm.c collected during one more
+     * replay of each trace 
+     */
+    if (mm_counters) {
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_util(trace, i, &ranges);
+	    printf("\nAllocator statistics for trace %d:\n", i);
+	    if (mm_stats_dump(stdout) < 0) {
+		printf("  not collected, rebuild mm.c with \"make clean; "
+		       "make STATS=1\"\n");
+		free_trace(trace);
+		break;
+	    }
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /* Optionally print a time series of the heap shape of each trace */
+    if (shape_interval) {
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_shape(trace, i, shape_interval);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace once more, timing every request, and
+     * print latency percentiles by request type and size
+     */
+    if (latency || results_file || baseline_file || new_baseline) {
+	if ((lat = (latency_t *)malloc(sizeof(latency_t))) == NULL)
+	    unix_error("lat malloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_latency(trace, lat, 0);
+	    store_latency(&mm_stats[i], lat);
+	    if (latency)
+		print_latency("mm malloc", i, trace, lat);
+	    if (latency && run_libc && libc_stats[i].valid) {
+		eval_latency(trace, lat, 1);
+		print_latency("libc malloc", i, trace, lat);
+	    }
+	    free_trace(trace);
+	}
+	free(lat);
+	if (latency)
+	    printf("\n");
+    }
+
+    /*
+     * Optionally replay independent copies of each trace on 1, 2, 4, ...
+     * max_threads threads to see how the packages scale under contention
+     */
+    if (max_threads > 0) {
+	for (j = 1; j < max_threads && num_counts < 31; j <<= 1)
+	    thread_counts[num_counts++] = j;
+	thread_counts[num_counts++] = max_threads;
+
+	mt_stats = (mtstats_t *)calloc(num_tracefiles * num_counts, 
+				       sizeof(mtstats_t));
+	if (mt_stats == NULL)
+	    unix_error("mt_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (j = 0; j < num_counts; j++)
+		mt_stats[i*num_counts + j] = 
+		    eval_mt_speed(trace, thread_counts[j], 0);
+	    free_trace(trace);
+	}
+	print_mt_results("mm malloc (one heap per thread)", 
+			 num_tracefiles, num_counts, mt_stats);
+
+	if (run_libc) {
+	    for (i=0; i < num_tracefiles; i++) {
+		trace = read_trace(tracedir, tracefiles[i]);
+		for (j = 0; j < num_counts; j++)
+		    mt_stats[i*num_counts + j] = 
+			eval_mt_speed(trace, thread_counts[j], 1);
+		free_trace(trace);
+	    }
+	    print_mt_results("libc malloc", num_tracefiles, num_counts, 
+			     mt_stats);
+	}
+	free(mt_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace again while reading and writing the
+     * payloads, to see what the allocator's placement costs the program
+     */
+    if (touch) {
+	mm_touch = (touchstats_t *)calloc(num_tracefiles, sizeof(touchstats_t));
+	libc_touch = (touchstats_t *)calloc(num_tracefiles, sizeof(touchstats_t));
+	if (mm_touch == NULL || libc_touch == NULL)
+	    unix_error("touchstats_t calloc in main failed");
+	perf_open();
+	touch_params.modes = touch;
+	touch_params.scan = touch_scan;
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    touch_params.trace = trace;
+	    for (touch_params.libc = 0; touch_params.libc <= run_libc; 
+		 touch_params.libc++) {
+		touchstats_t *t = touch_params.libc ? &libc_touch[i] : &mm_touch[i];
+		t->valid = touch_params.libc ? libc_stats[i].valid : mm_stats[i].valid;
+		if (!t->valid)
+		    continue;
+		t->secs = fsecs(eval_touch_speed, &touch_params);
+		perf_measure(eval_touch_speed, &touch_params, &t->events);
+	    }
+	    free_trace(trace);
+	}
+	perf_close();
+	print_touch_results(touch, touch_scan, num_tracefiles, mm_stats, 
+			    mm_touch, run_libc ? libc_stats : NULL, libc_touch);
+	free(mm_touch);
+	free(libc_touch);
+    }
+
+    /*
+     * Optionally replay each trace through movable handles, letting
+     * compaction squeeze out the fragmentation
+     */
+    if (handles) {
+	h_stats = (hstats_t *)calloc(num_tracefiles, sizeof(hstats_t));
+	if (h_stats == NULL)
+	    unix_error("h_stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_handles(trace, &h_stats[i]);
+	    free_trace(trace);
+	}
+	print_handle_results(num_tracefiles, h_stats, mm_stats);
+	free(h_stats);
+    }
+
+    /*
+     * Optionally time each trace with the sampling profiler on, and dump
+     * its profile where the trace's live payload peaks
+     */
+    if (prof_rate > 0) {
+	prof_stats = (profstats_t *)calloc(num_tracefiles, 
+					   sizeof(profstats_t));
+	if (prof_stats == NULL)
+	    unix_error("prof_stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_profile(trace, i, prof_rate, &prof_stats[i]);
+	    free_trace(trace);
+	}
+	print_profile_results(prof_rate, num_tracefiles, prof_stats, mm_stats);
+	free(prof_stats);
+    }
+
+    /*
+     * Optionally replay independent copies of each trace in 1, 2, 4, ...
+     * max_procs processes that all allocate from one shared heap
+     */
+    if (max_procs > 0) {
+	num_counts = 0;
+	for (j = 1; j < max_procs && num_counts < 31; j <<= 1)
+	    thread_counts[num_counts++] = j;
+	thread_counts[num_counts++] = max_procs;
+
+	mp_stats = (mpstats_t *)calloc(num_tracefiles * num_counts, 
+				       sizeof(mpstats_t));
+	if (mp_stats == NULL)
+	    unix_error("mp_stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (j = 0; j < num_counts; j++)
+		mp_stats[i*num_counts + j] = 
+		    eval_mp_speed(trace, thread_counts[j]);
+	    free_trace(trace);
+	}
+	print_mp_results(num_tracefiles, num_counts, mp_stats);
+	free(mp_stats);
+    }
+
+    /*
+     * Optionally report how much of the heap decay purging gave back
+     * during each replay, and after the heap then sat idle
+     */
+    if (decay_ms >= 0) {
+	decay_stats = (decaystats_t *)calloc(num_tracefiles, 
+					     sizeof(decaystats_t));
+	if (decay_stats == NULL)
+	    unix_error("decay_stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_decay(trace, decay_ms, &decay_stats[i]);
+	    free_trace(trace);
+	}
+	print_decay_results(decay_ms, num_tracefiles, decay_stats);
+	free(decay_stats);
+    }
+
+    /*
+     * Optionally time snapshots of the mm heap halfway through each
+     * trace, and how fast a heap comes back from one
+     */
+    if (snap_file != NULL) {
+	snap_stats = (snapstats_t *)calloc(num_tracefiles, 
+					   sizeof(snapstats_t));
+	if (snap_stats == NULL)
+	    unix_error("snap_stats calloc in main failed");
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_snapshot(trace, snap_file, &snap_stats[i]);
+	    free_trace(trace);
+	}
+	print_snapshot_results(num_tracefiles, snap_stats);
+	free(snap_stats);
+	unlink(snap_file);
+    }
+
+    /*
+     * Optionally show what MM_EXCLUSIVE buys: fs_threads threads bump
+     * their own counters, first packed as mm_malloc places them and
+     * then each on a cache line of its own
+     */
+    if (fs_threads > 0) {
+	double packed, excl;
+	int packed_shared, excl_shared;
+
+	packed = eval_false_sharing(fs_threads, 0, &packed_shared);
+	excl = eval_false_sharing(fs_threads, MM_EXCLUSIVE, &excl_shared);
+	printf("\nFalse sharing, %d threads x %d increments:\n", 
+	       fs_threads, FS_INCS);
+	printf("%-12s%14s%10s%16s\n", "placement", "shared line", "secs", 
+	       "Mops/thread");
+	printf("%-12s%14s%10.3f%16.1f\n", "packed", 
+	       packed_shared ? "yes" : "no", packed, FS_INCS/1e6/packed);
+	printf("%-12s%14s%10.3f%16.1f\n", "exclusive", 
+	       excl_shared ? "yes" : "no", excl, FS_INCS/1e6/excl);
+	printf("\n");
+    }
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -338,6 +1087,16 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    /* Emit the machine-readable results and check them for regressions */
+    if (results_file)
+	write_results(results_file, num_tracefiles, tracefiles, mm_stats, 
+		      perfindex);
+    if (new_baseline)
+	write_baseline(new_baseline, num_tracefiles, tracefiles, mm_stats);
+    if (baseline_file && 
+	check_baseline(baseline_file, num_tracefiles, tracefiles, mm_stats) > 0)
+	exit_code = 1;
+
     exit(exit_code);
 }
 
@@ -472,6 +1231,10 @@ static trace_t *read_trace(char *tracedir, char *filename)
     }
 	unix_error(msg);
     }
+    if (read_bintrace(tracefile, trace, path)) {
+	fclose(tracefile);
+	return trace;
+    }
     convs = fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     if(convs != 1) app_error("tracefile format");
     convs = fscanf(tracefile, "%d", &(trace->num_ids));     
@@ -517,6 +1280,14 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	    trace->ops[op_index].size = size;
 	    max_index = (index > max_index) ? index : max_index;
 	    break;
+	case 'c':
+        convs = fscanf(tracefile, "%u %u", &index, &size);
+        if(convs != 2) app_error("tracefile format");
+	    trace->ops[op_index].type = CALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
 	case 'f':
         convs = fscanf(tracefile, "%ud", &index);
         if(convs != 1) app_error("tracefile format");
@@ -538,6 +1309,77 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * read_bintrace - If tracefile is a binary trace (see bintrace.h), read
+ *     it into trace and return 1; otherwise rewind it and return 0
+ */
+static int read_bintrace(FILE *tracefile, trace_t *trace, char *path)
+{
+    bintrace_hdr_t hdr;
+    bintrace_op_t *buf;
+    size_t n, i;
+    unsigned max_index = 0;
+    int op_index = 0;
+
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) != 1 ||
+	memcmp(hdr.magic, BINTRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+	rewind(tracefile);
+	return 0;
+    }
+    trace->sugg_heapsize = hdr.sugg_heapsize;
+    trace->num_ids = hdr.num_ids;
+    trace->num_ops = hdr.num_ops;
+    trace->weight = hdr.weight;
+
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_bintrace");
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_bintrace");
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_bintrace");
+    if ((buf = (bintrace_op_t *)malloc(BINTRACE_CHUNK * 
+				       sizeof(bintrace_op_t))) == NULL)
+	unix_error("malloc 5 failed in read_bintrace");
+
+    /* Convert the records a chunk at a time */
+    while (op_index < trace->num_ops &&
+	   (n = fread(buf, sizeof(bintrace_op_t), BINTRACE_CHUNK, tracefile)) > 0) {
+	for (i = 0; i < n && op_index < trace->num_ops; i++, op_index++) {
+	    traceop_t *op = &trace->ops[op_index];
+	    switch (buf[i].type) {
+	    case 'a':
+		op->type = ALLOC;
+		break;
+	    case 'r':
+		op->type = REALLOC;
+		break;
+	    case 'c':
+		op->type = CALLOC;
+		break;
+	    case 'f':
+		op->type = FREE;
+		break;
+	    default:
+		printf("Bogus type character (%c) in tracefile %s\n", 
+		       buf[i].type, path);
+		exit(1);
+	    }
+	    op->index = buf[i].index;
+	    op->size = buf[i].size;
+	    if (op->type != FREE && buf[i].index > max_index)
+		max_index = buf[i].index;
+	}
+    }
+    free(buf);
+    if (op_index != trace->num_ops)
+	app_error("binary tracefile is truncated");
+    assert(max_index == trace->num_ids - 1);
+    return 1;
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
  *              to, all of which were allocated in read_trace().
@@ -555,6 +1397,18 @@ void free_trace(trace_t *trace)
  * and throughput of the libc and mm malloc packages.
  **********************************************************************/
 
+/*
+ * reset_heap - empty the mm heap before a replay; with -Z, also hand its
+ *     pages back to the OS so that the replay starts on fresh memory
+ */
+static void reset_heap(void)
+{
+    if (release_heap)
+	mem_release();
+    else
+	mem_reset_brk();
+}
+
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
@@ -569,7 +1423,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *p;
     
     /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    reset_heap();
     clear_ranges(ranges);
 
     /* Call the mm package's init function */
@@ -586,9 +1440,23 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
-
-	    /* Call the student's malloc */
-	    if ((p = mm_malloc(size)) == NULL) {
+        case CALLOC: /* mm_calloc */
+
+	    /* Call the student's malloc or calloc */
+	    if (trace->ops[i].type == CALLOC) {
+		if ((p = mm_calloc(1, size)) == NULL) {
+		    malloc_error(tracenum, i, "mm_calloc failed.");
+		    return 0;
+		}
+		for (j = 0; j < size; j++) {
+		    if (p[j] != 0) {
+			malloc_error(tracenum, i, "mm_calloc did not zero "
+				     "the block");
+			return 0;
+		    }
+		}
+	    }
+	    else if ((p = mm_malloc(size)) == NULL) {
 		malloc_error(tracenum, i, "mm_malloc failed.");
 		return 0;
 	    }
@@ -676,8 +1544,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
  *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
+ *   package on the trace. Note that mm_malloc never decrements the brk
+ *   pointer (only compacting the handle API's blocks does), so brk
  *   is always the high water mark of the heap. 
  *   
  */
@@ -692,7 +1560,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     char *newp, *oldp;
 
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
+    reset_heap();
     if (mm_init() < 0)
 	app_error("mm_init failed in eval_mm_util");
 
@@ -700,10 +1568,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case CALLOC: /* mm_calloc */
 	    index = trace->ops[i].index;
 	    size = trace->ops[i].size;
 
-	    if ((p = mm_malloc(size)) == NULL) 
+	    p = (trace->ops[i].type == CALLOC) ? 
+		mm_calloc(1, size) : mm_malloc(size);
+	    if (p == NULL) 
 		app_error("mm_malloc failed in eval_mm_util");
 	    
 	    /* Remember region and size */
@@ -775,7 +1646,7 @@ static void eval_mm_speed(void *ptr)
     trace_t *trace = ((speed_t *)ptr)->trace;
 
     /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
+    reset_heap();
     if (mm_init() < 0) 
 	app_error("mm_init failed in eval_mm_speed");
 
@@ -791,6 +1662,14 @@ static void eval_mm_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case CALLOC: /* mm_calloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_calloc(1, size)) == NULL)
+		app_error("mm_calloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
 	case REALLOC: /* mm_realloc */
 	    index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -811,27 +1690,278 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+
 /*
- * eval_libc_valid - We run this function to make sure that the
- *    libc malloc can run to completion on the set of traces.
- *    We'll be conservative and terminate if any libc malloc call fails.
- *
+ * eval_cache_modes - With -T, time f again starting from warm caches,
+ *     then from flushed ones, and put the times in stats
  */
-static int eval_libc_valid(trace_t *trace, int tracenum)
+static void eval_cache_modes(fsecs_test_funct f, speed_t *speed_params, 
+			     stats_t *stats)
 {
-    int i, newsize;
-    char *p, *newp, *oldp;
+    if (!cache_modes)
+	return;
+    set_fsecs_cache(FSECS_WARM);
+    stats->warm_secs = fsecs(f, speed_params);
+    set_fsecs_cache(FSECS_COLD);
+    stats->cold_secs = fsecs(f, speed_params);
+    set_fsecs_cache(FSECS_DEFAULT);
+}
 
-    for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
+/*
+ * eval_mm_trace - Check mm malloc on one trace, then measure its space
+ *     utilization and time it, filling in stats. Times with the benchmark
+ *     harness if bench_params is non-NULL, and counts hardware events if
+ *     events is non-NULL.
+ */
+static void eval_mm_trace(char *tracefile, int tracenum, int check_mode,
+			  bench_params_t *bench_params, stats_t *stats,
+			  bench_result_t *bench_result, perf_counts_t *events)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
 
-        case ALLOC: /* malloc */
-	    if ((p = malloc(trace->ops[i].size)) == NULL) {
-		malloc_error(tracenum, i, "libc malloc failed");
-		unix_error("System message");
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    mm_set_check(check_mode);
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges);
+    mm_set_check(MM_CHECK_OFF);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, &ranges);
+	stats->heap = mem_heapsize();
+	stats->payload = stats->util * stats->heap;
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	if (bench_params) {
+	    bench_run(eval_mm_speed, &speed_params, bench_params, bench_result);
+	    stats->secs = bench_result->median;
+	}
+	else
+	    stats->secs = fsecs(eval_mm_speed, &speed_params);
+	stats->kops = (stats->ops/1e3)/stats->secs;
+	eval_cache_modes(eval_mm_speed, &speed_params, stats);
+	if (events)
+	    perf_measure(eval_mm_speed, &speed_params, events);
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * eval_mm_parallel - Run eval_mm_trace on every trace in forked workers,
+ *     at most njobs at a time. Each worker has its own copy of the memlib
+ *     heap and of mm.c's globals, and sends its results back over a pipe.
+ *     A worker that crashes only fails its own trace. If pin_cpu >= 0,
+ *     the worker in slot k is pinned to CPU pin_cpu + k.
+ */
+static void eval_mm_parallel(int njobs, int pin_cpu, char **tracefiles, 
+			     int n, int check_mode, bench_params_t *bench_params,
+			     stats_t *stats, bench_result_t *bench_results)
+{
+    pid_t *pids, pid;
+    int *slot_trace, *slot_fd, fd[2];
+    int next = 0, running = 0, status, i, k;
+
+    /* 
+     * Calibrate fcyc's timer interrupt compensation once, while the
+     * driver is still alone on the machine, so the workers inherit it 
+     */
+    start_comp_counter();
+    get_comp_counter();
+
+    if ((pids = (pid_t *)calloc(njobs, sizeof(pid_t))) == NULL ||
+	(slot_trace = (int *)calloc(njobs, sizeof(int))) == NULL ||
+	(slot_fd = (int *)calloc(njobs, sizeof(int))) == NULL)
+	unix_error("calloc failed in eval_mm_parallel");
+
+    while (next < n || running > 0) {
+	/* Start another worker in a free slot */
+	if (next < n && running < njobs) {
+	    for (k = 0; pids[k] != 0; k++)
+		;
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in eval_mm_parallel");
+	    fflush(stdout);
+	    fflush(stderr);
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in eval_mm_parallel");
+	    if (pid == 0) {
+		bench_result_t *result = bench_params ? &bench_results[next] : NULL;
+
+		close(fd[0]);
+		if (pin_cpu >= 0 && bench_pin_cpu(pin_cpu + k) < 0)
+		    fprintf(stderr, "Warning: could not pin worker to CPU %d\n",
+			    pin_cpu + k);
+		errors = 0;
+		eval_mm_trace(tracefiles[next], next, check_mode, bench_params,
+			      &stats[next], result, NULL);
+		if (write_all(fd[1], &errors, sizeof(int)) < 0 ||
+		    write_all(fd[1], &stats[next], sizeof(stats_t)) < 0 ||
+		    (result && stats[next].valid && 
+		     (write_all(fd[1], result, sizeof(bench_result_t)) < 0 ||
+		      write_all(fd[1], result->samples, 
+				result->n * sizeof(double)) < 0)))
+		    unix_error("worker could not send its results");
+		fflush(stdout);
+		_exit(0);
 	    }
-	    trace->blocks[trace->ops[i].index] = p;
-	    break;
+	    close(fd[1]);
+	    pids[k] = pid;
+	    slot_trace[k] = next++;
+	    slot_fd[k] = fd[0];
+	    running++;
+	    continue;
+	}
+
+	/* Merge the results of the next worker to finish */
+	if ((pid = waitpid(-1, &status, 0)) < 0)
+	    unix_error("waitpid failed in eval_mm_parallel");
+	for (k = 0; k < njobs && pids[k] != pid; k++)
+	    ;
+	if (k == njobs)
+	    continue;
+	i = slot_trace[k];
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0 && 
+	    recv_mm_results(slot_fd[k], &stats[i], 
+			    bench_params ? &bench_results[i] : NULL) == 0)
+	    ;
+	else {
+	    if (WIFSIGNALED(status))
+		printf("ERROR [trace %d]: worker killed by signal %d (%s)\n", 
+		       i, WTERMSIG(status), strsignal(WTERMSIG(status)));
+	    else
+		printf("ERROR [trace %d]: worker exited without results\n", i);
+	    stats[i].valid = 0;
+	    errors++;
+	}
+	close(slot_fd[k]);
+	pids[k] = 0;
+	running--;
+    }
+    free(pids);
+    free(slot_trace);
+    free(slot_fd);
+}
+
+/*
+ * recv_mm_results - Read what an eval_mm_parallel worker sent back.
+ *     Returns 0 on success, -1 if the worker's data is incomplete.
+ */
+static int recv_mm_results(int fd, stats_t *stats, bench_result_t *result)
+{
+    int nerrors;
+
+    if (read_all(fd, &nerrors, sizeof(int)) < 0 ||
+	read_all(fd, stats, sizeof(stats_t)) < 0)
+	return -1;
+    errors += nerrors;
+    if (result && stats->valid) {
+	if (read_all(fd, result, sizeof(bench_result_t)) < 0)
+	    return -1;
+	if ((result->samples = (double *)malloc(result->n * sizeof(double))) 
+	    == NULL)
+	    unix_error("malloc failed in recv_mm_results");
+	if (read_all(fd, result->samples, result->n * sizeof(double)) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * eval_mm_shape - Replay a trace against the mm package and print the
+ *     shape of the heap every interval requests and at the end, so that
+ *     the phases of a trace that waste memory stand out.
+ */
+static void eval_mm_shape(trace_t *trace, int tracenum, int interval)
+{
+    int i, index, size;
+    size_t total_size = 0;
+    char *p;
+    heap_sample_t sample;
+
+    reset_heap();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_shape");
+
+    printf("\nHeap shape of trace %d, every %d requests:\n", 
+	   tracenum, interval);
+    heap_print_header(stdout);
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case CALLOC:
+	    p = (trace->ops[i].type == CALLOC) ? 
+		mm_calloc(1, size) : mm_malloc(size);
+	    if (p == NULL)
+		app_error("mm_malloc failed in eval_mm_shape");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    total_size += size;
+	    break;
+
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_shape");
+	    total_size += size - trace->block_sizes[index];
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    total_size -= trace->block_sizes[index];
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_shape");
+	}
+
+	if ((i + 1) % interval == 0 || i == trace->num_ops - 1) {
+	    heap_sample(&sample, i + 1, total_size);
+	    heap_print_sample(stdout, &sample);
+	}
+    }
+}
+
+/*
+ * eval_libc_valid - We run this function to make sure that the
+ *    libc malloc can run to completion on the set of traces.
+ *    We'll be conservative and terminate if any libc malloc call fails.
+ *
+ */
+static int eval_libc_valid(trace_t *trace, int tracenum)
+{
+    int i, newsize;
+    char *p, *newp, *oldp;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* malloc */
+	    if ((p = malloc(trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc malloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    if ((p = calloc(1, trace->ops[i].size)) == NULL) {
+		malloc_error(tracenum, i, "libc calloc failed");
+		unix_error("System message");
+	    }
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
 
 	case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
@@ -842,58 +1972,1484 @@ static int eval_libc_valid(trace_t *trace, int tracenum)
 	    }
 	    trace->blocks[trace->ops[i].index] = newp;
 	    break;
-	    
-        case FREE: /* free */
-	    free(trace->blocks[trace->ops[i].index]);
+	    
+        case FREE: /* free */
+	    free(trace->blocks[trace->ops[i].index]);
+	    break;
+
+	default:
+	    app_error("invalid operation type  in eval_libc_valid");
+	}
+    }
+
+    return 1;
+}
+
+/* 
+ * eval_libc_speed - This is the function that is used by fcyc() to
+ *    measure the running time of the libc malloc package on the set
+ *    of traces.
+ */
+static void eval_libc_speed(void *ptr)
+{
+    int i;
+    int index, size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: /* malloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = malloc(size)) == NULL)
+		unix_error("malloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+        case CALLOC: /* calloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = calloc(1, size)) == NULL)
+		unix_error("calloc failed in eval_libc_speed");
+	    trace->blocks[index] = p;
+	    break;
+
+	case REALLOC: /* realloc */
+	    index = trace->ops[i].index;
+	    newsize = trace->ops[i].size;
+	    oldp = trace->blocks[index];
+	    if ((newp = realloc(oldp, newsize)) == NULL)
+		unix_error("realloc failed in eval_libc_speed\n");
+	    
+	    trace->blocks[index] = newp;
+	    break;
+	    
+        case FREE: /* free */
+	    index = trace->ops[i].index;
+	    block = trace->blocks[index];
+	    free(block);
+	    break;
+	}
+    }
+}
+
+/*
+ * parse_touch - Parse the -x access patterns: w writes each payload once
+ *     when it is allocated (or grown), r reads a payload back before it
+ *     is freed, and s[<n>] reads a byte per line of every live block
+ *     every n requests (TOUCH_SCAN_OPS by default). Returns the TOUCH_*
+ *     modes, or -1 for anything else.
+ */
+static int parse_touch(char *arg, int *scan)
+{
+    int modes = 0;
+
+    while (*arg) {
+	switch (*arg++) {
+	case 'w':
+	    modes |= TOUCH_WRITE;
+	    break;
+	case 'r':
+	    modes |= TOUCH_READ;
+	    break;
+	case 's':
+	    modes |= TOUCH_SCAN;
+	    if (isdigit((int)*arg) && (*scan = strtol(arg, &arg, 10)) < 1)
+		return -1;
+	    break;
+	default:
+	    return -1;
+	}
+    }
+    return modes;
+}
+
+/*
+ * touch_read - Read size bytes at p, one byte in every stride
+ */
+static unsigned long touch_read(char *p, size_t size, size_t stride)
+{
+    unsigned long sum = 0;
+    size_t j;
+
+    for (j = 0; j < size; j += stride)
+	sum += p[j];
+    return sum;
+}
+
+/*
+ * eval_touch_speed - Replay a trace on mm or libc malloc like
+ *     eval_mm_speed and eval_libc_speed do, but use the memory along
+ *     the way, as a program would, in the ways the touch_t's modes say. The
+ *     time then includes the cache and TLB misses the blocks' placement
+ *     causes in the program, not only in the allocator.
+ */
+static void eval_touch_speed(void *ptr)
+{
+    touch_t *t = (touch_t *)ptr;
+    trace_t *trace = t->trace;
+    int i, id, index, size, oldsize;
+    char *p;
+
+    if (!t->libc) {
+	reset_heap();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_touch_speed");
+    }
+    memset(trace->blocks, 0, trace->num_ids * sizeof(char *));
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	oldsize = 0;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = t->libc ? malloc(size) : mm_malloc(size);
+	    break;
+	case CALLOC:
+	    p = t->libc ? calloc(1, size) : mm_calloc(1, size);
+	    break;
+	case REALLOC:
+	    oldsize = trace->block_sizes[index];
+	    p = t->libc ? realloc(trace->blocks[index], size) : 
+		mm_realloc(trace->blocks[index], size);
+	    break;
+	default:
+	    p = trace->blocks[index];
+	    if (t->modes & TOUCH_READ)
+		t->sum += touch_read(p, trace->block_sizes[index], 1);
+	    if (t->libc)
+		free(p);
+	    else
+		mm_free(p);
+	    trace->blocks[index] = NULL;
+	    p = NULL;
+	}
+	if (trace->ops[i].type != FREE) {
+	    if (p == NULL)
+		app_error("allocation failed in eval_touch_speed");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    if ((t->modes & TOUCH_WRITE) && size > oldsize)
+		memset(p + oldsize, (char)i, size - oldsize);
+	}
+
+	if ((t->modes & TOUCH_SCAN) && (i + 1) % t->scan == 0) {
+	    for (id = 0; id < trace->num_ids; id++)
+		if (trace->blocks[id] != NULL)
+		    t->sum += touch_read(trace->blocks[id], 
+					 trace->block_sizes[id], TOUCH_LINE);
+	}
+    }
+}
+
+/*
+ * print_touch_results - prints how long each trace took when its
+ *     payloads were used, next to the time for the allocator alone, and
+ *     the cache misses per 1000 requests, for mm and (with -l) libc
+ */
+static void print_touch_results(int modes, int scan, int ntraces, 
+				stats_t *mm_stats, touchstats_t *mm_touch,
+				stats_t *libc_stats, touchstats_t *libc_touch)
+{
+    int i, k, e, ev[2] = {PERF_L1D_MISSES, PERF_LLC_MISSES};
+    stats_t *s;
+    touchstats_t *t;
+
+    printf("\nReplay using the payloads (");
+    if (modes & TOUCH_WRITE)
+	printf("write once%s", modes & ~TOUCH_WRITE ? ", " : "");
+    if (modes & TOUCH_READ)
+	printf("read on free%s", modes & TOUCH_SCAN ? ", " : "");
+    if (modes & TOUCH_SCAN)
+	printf("scan every %d requests", scan);
+    printf("):\n%5s", "trace");
+    for (k = 0; k < (libc_stats ? 2 : 1); k++)
+	printf("%8s(ms)%10s%10s%10s", k ? "libc" : "mm", "alloc(ms)", 
+	       perf_names[ev[0]], perf_names[ev[1]]);
+    printf("\n");
+    for (i = 0; i < ntraces; i++) {
+	printf("%2d   ", i);
+	for (k = 0; k < (libc_stats ? 2 : 1); k++) {
+	    s = k ? &libc_stats[i] : &mm_stats[i];
+	    t = k ? &libc_touch[i] : &mm_touch[i];
+	    if (!t->valid) {
+		printf("%12s%10s%10s%10s", "-", "-", "-", "-");
+		continue;
+	    }
+	    printf("%12.3f%10.3f", t->secs * 1e3, s->secs * 1e3);
+	    for (e = 0; e < 2; e++) {
+		if (t->events.valid[ev[e]])
+		    printf("%10.1f", t->events.count[ev[e]] * 1e3 / s->ops);
+		else
+		    printf("%10s", "-");
+	    }
+	}
+	printf("\n");
+    }
+    printf("(misses are per 1000 requests, over the whole touching replay)\n");
+}
+
+/**********************************************************************
+ * The following functions replay independent copies of a trace on
+ * several threads at once and measure the aggregate throughput and
+ * the tail latency of individual requests.
+ **********************************************************************/
+
+/*
+ * mt_malloc, mt_calloc, mt_realloc, mt_free - Route a request from a replay thread
+ *     to either libc or the thread's own mm heap
+ */
+static void *mt_malloc(thread_arg_t *arg, size_t size)
+{
+    if (arg->libc)
+	return malloc(size);
+    return mm_malloc_inline(arg->heap, size);
+}
+
+static void *mt_calloc(thread_arg_t *arg, size_t size)
+{
+    if (arg->libc)
+	return calloc(1, size);
+    return mm_calloc_h(arg->heap, 1, size);
+}
+
+static void *mt_realloc(thread_arg_t *arg, void *ptr, size_t size)
+{
+    if (arg->libc)
+	return realloc(ptr, size);
+    return mm_realloc_h(arg->heap, ptr, size);
+}
+
+static void mt_free(thread_arg_t *arg, void *ptr)
+{
+    if (arg->libc)
+	free(ptr);
+    else
+	mm_free_inline(arg->heap, ptr);
+}
+
+/*
+ * mt_replay - Thread routine that replays one private copy of a trace 
+ *     THREAD_REPS times, timing every LAT_SAMPLE'th request. A thread
+ *     whose request fails returns at once, so it must still show up at
+ *     the start barrier first.
+ */
+static void *mt_replay(void *ptr)
+{
+    thread_arg_t *arg = (thread_arg_t *)ptr;
+    trace_t *trace = arg->trace;
+    int i, r, index, timed;
+    char *p;
+    double start = 0;
+
+    /* 
+     * The first pass is an untimed warmup that lets libc set up its 
+     * per-thread arenas before the clock starts 
+     */
+    for (r = -1; r < THREAD_REPS; r++) {
+	if (r == 0) {
+	    pthread_barrier_wait(arg->start);
+	    arg->t_start = wall_secs();
+	}
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    timed = (r >= 0) && (i % LAT_SAMPLE) == 0;
+	    if (timed)
+		start = wall_secs();
+
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		if ((p = mt_malloc(arg, trace->ops[i].size)) == NULL) 
+		    goto failed;
+		arg->blocks[index] = p;
+		break;
+
+	    case CALLOC:
+		if ((p = mt_calloc(arg, trace->ops[i].size)) == NULL) 
+		    goto failed;
+		arg->blocks[index] = p;
+		break;
+
+	    case REALLOC:
+		p = mt_realloc(arg, arg->blocks[index], 
+			       trace->ops[i].size);
+		if (p == NULL)
+		    goto failed;
+		arg->blocks[index] = p;
+		break;
+
+	    case FREE:
+		mt_free(arg, arg->blocks[index]);
+		arg->blocks[index] = NULL;
+		break;
+	    }
+
+	    if (timed)
+		arg->lat[arg->nlat++] = wall_secs() - start;
+	}
+
+	/* Release whatever an unbalanced trace left allocated */
+	for (index = 0; index < trace->num_ids; index++) {
+	    if (arg->blocks[index] != NULL) {
+		mt_free(arg, arg->blocks[index]);
+		arg->blocks[index] = NULL;
+	    }
+	}
+    }
+    arg->t_end = wall_secs();
+    return NULL;
+
+ failed:
+    arg->failed = 1;
+    if (r < 0) {
+	pthread_barrier_wait(arg->start);
+	arg->t_start = wall_secs();
+    }
+    arg->t_end = wall_secs();
+    return NULL;
+}
+
+/*
+ * eval_mt_speed - Replay nthreads independent copies of a trace, one
+ *     per thread, against libc malloc (libc != 0) or the mm package. 
+ */
+static mtstats_t eval_mt_speed(trace_t *trace, int nthreads, int libc)
+{
+    int i, j, nlat = 0;
+    int maxlat = THREAD_REPS * (trace->num_ops / LAT_SAMPLE + 1);
+    double start, end, *lat;
+    pthread_t *tids;
+    thread_arg_t *args;
+    pthread_barrier_t barrier;
+    mtstats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.nthreads = nthreads;
+    stats.ops = (double)trace->num_ops * THREAD_REPS * nthreads;
+
+    if ((tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t))) == NULL ||
+	(args = (thread_arg_t *)calloc(nthreads, sizeof(thread_arg_t))) == NULL ||
+	(lat = (double *)malloc(nthreads * maxlat * sizeof(double))) == NULL)
+	unix_error("calloc failed in eval_mt_speed");
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+
+    for (i = 0; i < nthreads; i++) {
+	args[i].trace = trace;
+	args[i].libc = libc;
+	args[i].start = &barrier;
+	args[i].lat = lat + i * maxlat;
+	if (!libc) {
+	    /* Each thread gets a private heap the size of the default one */
+	    if ((args[i].mem = 
+		 memlib_create(memlib_max_heap(mem_default()))) == NULL ||
+		(args[i].heap = mm_create(args[i].mem)) == NULL)
+		app_error("could not create a heap in eval_mt_speed");
+	}
+	if ((args[i].blocks = (char **)calloc(trace->num_ids, 
+					      sizeof(char *))) == NULL)
+	    unix_error("calloc failed in eval_mt_speed");
+	if (pthread_create(&tids[i], NULL, mt_replay, &args[i]) != 0)
+	    unix_error("pthread_create failed in eval_mt_speed");
+    }
+
+    /* 
+     * Let the threads go once all are waiting at the barrier. Each one
+     * reads the clock as it leaves it, as this thread may get to run
+     * again only after some have finished; the replay spans from the
+     * first start to the last end.
+     */
+    pthread_barrier_wait(&barrier);
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    start = args[0].t_start;
+    end = args[0].t_end;
+    for (i = 1; i < nthreads; i++) {
+	if (args[i].t_start < start)
+	    start = args[i].t_start;
+	if (args[i].t_end > end)
+	    end = args[i].t_end;
+    }
+    stats.secs = end - start;
+
+    /* Pool the latency samples of all threads */
+    stats.valid = 1;
+    for (i = 0; i < nthreads; i++) {
+	if (args[i].failed)
+	    stats.valid = 0;
+	for (j = 0; j < args[i].nlat; j++)
+	    lat[nlat++] = args[i].lat[j];
+	free(args[i].blocks);
+	if (!libc) {
+	    mm_destroy(args[i].heap);
+	    memlib_destroy(args[i].mem);
+	}
+    }
+    if (nlat > 0) {
+	qsort(lat, nlat, sizeof(double), cmp_double);
+	stats.p50 = lat[(int)(0.50 * (nlat - 1))];
+	stats.p99 = lat[(int)(0.99 * (nlat - 1))];
+	stats.p999 = lat[(int)(0.999 * (nlat - 1))];
+    }
+
+    pthread_barrier_destroy(&barrier);
+    free(lat);
+    free(args);
+    free(tids);
+    return stats;
+}
+
+/*
+ * eval_mm_handles - Replay a trace on the mm heap with mm_halloc,
+ *     mm_hrealloc and mm_hfree, stamping the first and last byte of
+ *     each block through mm_hlock and checking them again before the
+ *     block is resized or freed, so a block that compaction moved wrong
+ *     shows up. Utilization is the peak live payload over the peak heap
+ *     size, as the heap now shrinks when it is compacted.
+ */
+static void eval_mm_handles(trace_t *trace, hstats_t *stats)
+{
+    int i, index, size, ok = 1;
+    size_t live = 0, peak_live = 0;
+    mm_handle_t *hds;
+    int *sizes;
+    char *p, stamp;
+    double start;
+
+    if ((hds = (mm_handle_t *)calloc(trace->num_ids, sizeof(mm_handle_t))) == NULL ||
+	(sizes = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc in eval_mm_handles failed");
+    memset(stats, 0, sizeof(*stats));
+    stats->ops = trace->num_ops;
+
+    reset_heap();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_handles");
+    start = wall_secs();
+    for (i = 0; ok && i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	stamp = (char)index;
+
+	/* Check the stamps of a block we are about to resize or free */
+	if (trace->ops[i].type == REALLOC || trace->ops[i].type == FREE) {
+	    p = mm_hlock(hds[index]);
+	    ok = (p != NULL && p[0] == stamp && p[sizes[index] - 1] == stamp);
+	    mm_hunlock(hds[index]);
+	    live -= sizes[index];
+	}
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	case CALLOC:
+	    ok = ok && (hds[index] = mm_halloc(size)) != 0;
+	    break;
+	case REALLOC:
+	    ok = ok && mm_hrealloc(hds[index], size) == 0;
+	    break;
+	default:
+	    mm_hfree(hds[index]);
+	    hds[index] = 0;
+	    continue;
+	}
+	if (!ok)
+	    break;
+	p = mm_hlock(hds[index]);
+	p[0] = p[size - 1] = stamp;
+	mm_hunlock(hds[index]);
+	sizes[index] = size;
+
+	live += size;
+	if (live > peak_live)
+	    peak_live = live;
+	if (mem_heapsize() > stats->peak_heap)
+	    stats->peak_heap = mem_heapsize();
+    }
+    stats->secs = wall_secs() - start;
+
+    mm_compact();
+    stats->final_heap = mem_heapsize();
+    mm_compact_stats(&stats->compact);
+    stats->valid = ok && mm_check() == 0;
+    stats->util = stats->peak_heap ? (double)peak_live / stats->peak_heap : 0;
+    free(sizes);
+    free(hds);
+}
+
+/*
+ * print_handle_results - prints what utilization each trace reached
+ *     through handles, next to what plain mm_malloc got, and how much
+ *     compacting it took
+ */
+static void print_handle_results(int ntraces, hstats_t *stats, 
+				 stats_t *mm_stats)
+{
+    int i;
+    hstats_t *s;
+
+    printf("\nReplay through movable handles (mm_halloc), compacting:\n");
+    printf("%5s%6s%7s%7s%8s%10s%10s%11s%12s\n", "trace", "valid", "util", 
+	   "plain", "Kops", "compacts", "moved(KB)", "peak(KB)", "final(KB)");
+    for (i = 0; i < ntraces; i++) {
+	s = &stats[i];
+	if (!s->valid) {
+	    printf("%2d %8s\n", i, "no");
+	    continue;
+	}
+	printf("%2d %8s %5.0f%% %5.0f%% %7.0f %9lu %9.0f %10.0f %11.0f\n", 
+	       i, "yes", s->util * 100.0, mm_stats[i].util * 100.0,
+	       (s->ops/1e3)/s->secs, s->compact.compactions, 
+	       s->compact.moved / 1024.0, s->peak_heap / 1024.0, 
+	       s->final_heap / 1024.0);
+    }
+}
+
+/*
+ * eval_mm_profile - Time a trace with the profiler sampling about one
+ *     allocation in every rate bytes, then replay it once more up to the
+ *     request where its live payload peaks and write the profile to
+ *     mdriver-<tracenum>.heap (for "pprof mdriver <file>"). Every sample
+ *     comes from the same call site in a replay, so the profile shows
+ *     the sampling at work rather than anything about the trace's
+ *     callers.
+ */
+static void eval_mm_profile(trace_t *trace, int tracenum, size_t rate, 
+			    profstats_t *stats)
+{
+    int i, peak_op = 0, *sizes;
+    long live = 0, peak = 0;
+    speed_t speed_params;
+
+    /* Find where the live payload peaks */
+    if ((sizes = (int *)calloc(trace->num_ids, sizeof(int))) == NULL)
+	unix_error("calloc in eval_mm_profile failed");
+    for (i = 0; i < trace->num_ops; i++) {
+	live -= sizes[trace->ops[i].index];
+	sizes[trace->ops[i].index] = 0;
+	if (trace->ops[i].type != FREE)
+	    sizes[trace->ops[i].index] = trace->ops[i].size;
+	live += sizes[trace->ops[i].index];
+	if (live > peak) {
+	    peak = live;
+	    peak_op = i;
+	}
+    }
+    free(sizes);
+
+    stats->ops = trace->num_ops;
+    if (mm_set_profile(rate) < 0)
+	app_error("mm_set_profile failed in eval_mm_profile");
+    speed_params.trace = trace;
+    stats->secs = fsecs(eval_mm_speed, &speed_params);
+
+    reset_heap();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_profile");
+    if (replay_mm(trace, 0, peak_op + 1) < 0)
+	return;
+    sprintf(stats->path, "mdriver-%d.heap", tracenum);
+    if (mm_profile_dump(stats->path) < 0)
+	unix_error("mm_profile_dump failed in eval_mm_profile");
+    mm_profile_stats(&stats->peak);
+    if (replay_mm(trace, peak_op + 1, trace->num_ops) < 0)
+	return;
+    mm_profile_stats(&stats->end);
+    stats->valid = mm_check() == 0 && stats->end.live == 0;
+    mm_set_profile(0);
+}
+
+/*
+ * print_profile_results - prints each trace's throughput with the
+ *     profiler sampling, next to that without it, and what it sampled
+ */
+static void print_profile_results(size_t rate, int ntraces, 
+				  profstats_t *stats, stats_t *mm_stats)
+{
+    int i;
+    profstats_t *s;
+    double kops;
+
+    printf("\nSampling profiler (about one sample per %lu bytes):\n", 
+	   (unsigned long)rate);
+    printf("%5s%6s%8s%8s%7s%9s%7s%12s  %s\n", "trace", "valid", "Kops", 
+	   "plain", "cost", "samples", "sites", "live@peak", "profile");
+    for (i = 0; i < ntraces; i++) {
+	s = &stats[i];
+	if (!s->valid || !mm_stats[i].valid) {
+	    printf("%2d %8s\n", i, "no");
+	    continue;
+	}
+	kops = (s->ops/1e3)/s->secs;
+	printf("%2d %8s %7.0f %7.0f %5.1f%% %8lu %6lu %11lu  %s\n", 
+	       i, "yes", kops, mm_stats[i].kops, 
+	       (mm_stats[i].kops / kops - 1) * 100.0, s->end.samples, 
+	       s->end.sites, s->peak.live, s->path);
+    }
+}
+
+/*
+ * mp_replay - Child process routine that replays one private copy of a
+ *     trace THREAD_REPS times on the shared heap, taking the heap's lock
+ *     around each request. It stamps the first byte of each block and
+ *     checks the stamp is intact when it frees or resizes it, which
+ *     catches two processes getting the same memory. At the end it
+ *     leaves a result block in the heap for the parent. Returns 0 if all
+ *     went well. It shows up at the barrier even if it can't run, so as
+ *     not to leave the others waiting there.
+ */
+static int mp_replay(trace_t *trace, memlib_t *mem, mm_heap_t *heap, 
+		     mpctl_t *ctl, int id)
+{
+    int i, r, index;
+    char *p, **blocks, stamp;
+    mpresult_t *res;
+
+    blocks = (char **)calloc(trace->num_ids, sizeof(char *));
+    pthread_barrier_wait(&ctl->start);
+    ctl->proc[id].start = wall_secs();
+    if (blocks == NULL)
+	goto failed;
+    for (r = 0; r < THREAD_REPS; r++) {
+	for (i = 0;  i < trace->num_ops;  i++) {
+	    index = trace->ops[i].index;
+	    stamp = (char)(id * 31 + index);
+	    if (trace->ops[i].type != ALLOC && trace->ops[i].type != CALLOC &&
+		blocks[index] != NULL && blocks[index][0] != stamp)
+		goto failed;
+
+	    mm_lock_h(heap);
+	    switch (trace->ops[i].type) {
+	    case ALLOC:
+		p = mm_malloc_h(heap, trace->ops[i].size);
+		break;
+	    case CALLOC:
+		p = mm_calloc_h(heap, 1, trace->ops[i].size);
+		break;
+	    case REALLOC:
+		p = mm_realloc_h(heap, blocks[index], trace->ops[i].size);
+		break;
+	    default:
+		mm_free_h(heap, blocks[index]);
+		p = NULL;
+		break;
+	    }
+	    mm_unlock_h(heap);
+
+	    if (p == NULL && trace->ops[i].type != FREE)
+		goto failed;
+	    if (p != NULL)
+		p[0] = stamp;
+	    blocks[index] = p;
+	}
+
+	/* Release whatever an unbalanced trace left allocated */
+	mm_lock_h(heap);
+	for (index = 0; index < trace->num_ids; index++) {
+	    if (blocks[index] != NULL) {
+		mm_free_h(heap, blocks[index]);
+		blocks[index] = NULL;
+	    }
+	}
+	mm_unlock_h(heap);
+    }
+    ctl->proc[id].end = wall_secs();
+
+    mm_lock_h(heap);
+    res = (mpresult_t *)mm_malloc_h(heap, sizeof(mpresult_t));
+    mm_unlock_h(heap);
+    if (res == NULL)
+	goto failed;
+    res->magic = MP_MAGIC;
+    res->id = id;
+    res->ops = (double)trace->num_ops * THREAD_REPS;
+    ctl->proc[id].result = (char *)res - (char *)memlib_heap_lo(mem);
+    free(blocks);
+    return 0;
+
+ failed:
+    ctl->proc[id].end = wall_secs();
+    free(blocks);
+    return -1;
+}
+
+/*
+ * eval_mp_speed - Fork nprocs processes that each replay their own copy
+ *     of a trace on one shared mm heap. The parent then reads every
+ *     child's result block from the heap and checks the heap.
+ */
+static mpstats_t eval_mp_speed(trace_t *trace, int nprocs)
+{
+    int i, status;
+    size_t ctlsize = sizeof(mpctl_t)
+	+ (nprocs - 1) * sizeof(((mpctl_t *)0)->proc[0]);
+    double start, end;
+    pid_t pid;
+    pthread_barrierattr_t attr;
+    mpctl_t *ctl;
+    mpresult_t *res;
+    memlib_t *mem;
+    mm_heap_t *heap;
+    mpstats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.nprocs = nprocs;
+    stats.ops = (double)trace->num_ops * THREAD_REPS * nprocs;
+
+    if ((mem = memlib_create_shared(memlib_max_heap(mem_default()) * nprocs)) == NULL)
+	unix_error("memlib_create_shared in eval_mp_speed failed");
+    if ((heap = mm_create_shared(mem)) == NULL)
+	app_error("mm_create_shared failed in eval_mp_speed");
+    ctl = (mpctl_t *)mmap(NULL, ctlsize, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED)
+	unix_error("mmap in eval_mp_speed failed");
+    pthread_barrierattr_init(&attr);
+    pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(&ctl->start, &attr, nprocs + 1);
+    pthread_barrierattr_destroy(&attr);
+
+    fflush(stdout);
+    for (i = 0; i < nprocs; i++) {
+	if ((pid = fork()) < 0)
+	    unix_error("fork in eval_mp_speed failed");
+	if (pid == 0)
+	    _exit(mp_replay(trace, mem, heap, ctl, i) < 0);
+    }
+    /* 
+     * The parent may get to run again only after some children are
+     * done, so they read the clock themselves; the replay spans from
+     * the first start to the last end
+     */
+    pthread_barrier_wait(&ctl->start);
+    stats.valid = 1;
+    for (i = 0; i < nprocs; i++) {
+	if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    stats.valid = 0;
+    }
+    start = ctl->proc[0].start;
+    end = ctl->proc[0].end;
+    for (i = 1; i < nprocs; i++) {
+	if (ctl->proc[i].start < start)
+	    start = ctl->proc[i].start;
+	if (ctl->proc[i].end > end)
+	    end = ctl->proc[i].end;
+    }
+    stats.secs = end - start;
+
+    /* The children's results are in the heap; no copies were made */
+    mm_lock_h(heap);
+    for (i = 0; stats.valid && i < nprocs; i++) {
+	res = (mpresult_t *)((char *)memlib_heap_lo(mem) + ctl->proc[i].result);
+	if (res->magic != MP_MAGIC || res->id != i)
+	    stats.valid = 0;
+	else
+	    mm_free_h(heap, res);
+    }
+    if (mm_check_h(heap) < 0)
+	stats.valid = 0;
+    stats.heapsize = memlib_heapsize(mem);
+    mm_unlock_h(heap);
+
+    pthread_barrier_destroy(&ctl->start);
+    munmap(ctl, ctlsize);
+    mm_destroy(heap);
+    memlib_destroy(mem);
+    return stats;
+}
+
+/*
+ * print_mp_results - prints the aggregate throughput of each
+ *     multi-process replay and how far the shared heap grew
+ */
+static void print_mp_results(int ntraces, int ncounts, mpstats_t *stats)
+{
+    int i, c;
+    mpstats_t *s;
+
+    printf("\nMulti-process replay on one shared mm heap:\n");
+    printf("(%d passes per process, one process-shared lock around each request)\n",
+	   THREAD_REPS);
+    printf("%5s%8s%10s%10s\n", "trace", "procs", "Kops", "heap(KB)");
+    for (i = 0; i < ntraces; i++) {
+	for (c = 0; c < ncounts; c++) {
+	    s = &stats[i*ncounts + c];
+	    if (!s->valid) {
+		printf("%2d %7d %9s %9s\n", i, s->nprocs, "-", "-");
+		continue;
+	    }
+	    printf("%2d %7d %9.0f %9.0f\n", i, s->nprocs, 
+		   (s->ops/1e3)/s->secs, s->heapsize / 1024.0);
+	}
+    }
+    printf("\n");
+}
+
+/*
+ * eval_mm_decay - Replay a trace with mm, then leave the heap idle for
+ *     a whole decay window and one epoch more, and run the purge check
+ *     once. By then the decay curve lets nothing freed stay resident.
+ */
+static void eval_mm_decay(trace_t *trace, long ms, decaystats_t *stats)
+{
+    speed_t speed_params;
+    double start;
+
+    speed_params.trace = trace;
+    start = wall_secs();
+    eval_mm_speed(&speed_params);
+    stats->secs = wall_secs() - start;
+    mm_decay_stats(&stats->run);
+
+    usleep((ms + ms / MM_DECAY_EPOCHS + 1) * 1000);
+    mm_decay();
+    mm_decay_stats(&stats->idle);
+}
+
+/*
+ * print_decay_results - prints the bytes purged and the release rate
+ *     during each replay, what was still resident at its end, and how
+ *     much went back once the heap was idle
+ */
+static void print_decay_results(long ms, int ntraces, decaystats_t *stats)
+{
+    int i;
+    decaystats_t *d;
+
+    printf("\nDecay purging (%ld ms window) for mm malloc:\n", ms);
+    printf("%5s%10s%12s%9s%10s%12s%12s%12s\n", "trace", "secs", "purged(KB)", 
+	   "blocks", "MB/s", "left(KB)", "idle(KB)", "left(KB)");
+    for (i = 0; i < ntraces; i++) {
+	d = &stats[i];
+	printf("%2d %12.6f %11.0f %8lu %9.1f %11.0f %11.0f %11.0f\n", 
+	       i,
+	       d->secs,
+	       d->run.released / 1024.0,
+	       d->run.purges,
+	       d->secs > 0 ? d->run.released / 1e6 / d->secs : 0.0,
+	       d->run.dirty / 1024.0,
+	       (d->idle.released - d->run.released) / 1024.0,
+	       d->idle.dirty / 1024.0);
+    }
+}
+
+/*
+ * replay_mm - Replay requests lo..hi-1 of a trace on the mm package.
+ *     Returns -1 if a request fails.
+ */
+static int replay_mm(trace_t *trace, int lo, int hi)
+{
+    int i, index;
+    char *p;
+
+    for (i = lo; i < hi; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    p = mm_malloc(trace->ops[i].size);
+	    break;
+	case CALLOC:
+	    p = mm_calloc(1, trace->ops[i].size);
+	    break;
+	case REALLOC:
+	    p = mm_realloc(trace->blocks[index], trace->ops[i].size);
 	    break;
-
 	default:
-	    app_error("invalid operation type  in eval_libc_valid");
+	    mm_free(trace->blocks[index]);
+	    p = trace->blocks[index] = NULL;
+	    continue;
 	}
+	if (p == NULL)
+	    return -1;
+	trace->blocks[index] = p;
     }
+    return 0;
+}
 
-    return 1;
+/*
+ * eval_mm_snapshot - Build an mm heap with the first half of a trace and
+ *     snapshot it to path. Restore it over the heap it came from and
+ *     finish the trace on it, then restore it again into a new memlib,
+ *     which lands elsewhere (the first one is still in use) and so has
+ *     its free lists relocated. Both heaps must pass mm_check.
+ */
+static void eval_mm_snapshot(trace_t *trace, char *path, snapstats_t *stats)
+{
+    int half = trace->num_ops / 2;
+    double start;
+    memlib_t *mem;
+    mm_heap_t *heap;
+
+    reset_heap();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_snapshot");
+    start = wall_secs();
+    if (replay_mm(trace, 0, half) < 0)
+	return;
+    stats->build = wall_secs() - start;
+    stats->heapsize = mem_heapsize();
+
+    start = wall_secs();
+    if (mm_snapshot(path) < 0)
+	unix_error("mm_snapshot failed in eval_mm_snapshot");
+    stats->save = wall_secs() - start;
+
+    start = wall_secs();
+    if (mm_restore(path) < 0)
+	app_error("mm_restore failed in eval_mm_snapshot");
+    stats->restore = wall_secs() - start;
+    start = wall_secs();
+    if (replay_mm(trace, half, trace->num_ops) < 0)
+	return;
+    stats->finish = wall_secs() - start;
+    if (mm_check() < 0)
+	return;
+
+    start = wall_secs();
+    heap = mm_open_snapshot(path, memlib_max_heap(mem_default()), &mem);
+    stats->reloc = wall_secs() - start;
+    if (heap == NULL)
+	app_error("mm_open_snapshot failed in eval_mm_snapshot");
+    stats->moved = memlib_heap_lo(mem) != mem_heap_lo();
+    stats->valid = mm_check_h(heap) == 0;
+    mm_destroy(heap);
+    memlib_destroy(mem);
 }
 
-/* 
- * eval_libc_speed - This is the function that is used by fcyc() to
- *    measure the running time of the libc malloc package on the set
- *    of traces.
+/*
+ * print_snapshot_results - prints how long each heap took to build, save
+ *     and restore, and to finish its trace once restored
  */
-static void eval_libc_speed(void *ptr)
+static void print_snapshot_results(int ntraces, snapstats_t *stats)
 {
     int i;
-    int index, size, newsize;
-    char *p, *newp, *oldp, *block;
-    trace_t *trace = ((speed_t *)ptr)->trace;
+    snapstats_t *s;
+
+    printf("\nSnapshots of the mm heap halfway through each trace:\n");
+    printf("(restore maps the file over the heap; finish replays the rest of "
+	   "the trace on it;\n reloc restores into a new memlib)\n");
+    printf("%5s%6s%10s%12s%12s%12s%12s%12s%7s\n", "trace", "valid", "heap(KB)",
+	   "build(us)", "save(us)", "restore(us)", "finish(us)", "reloc(us)", 
+	   "moved");
+    for (i = 0; i < ntraces; i++) {
+	s = &stats[i];
+	if (!s->valid) {
+	    printf("%2d %8s\n", i, "no");
+	    continue;
+	}
+	printf("%2d %8s %9.0f %11.0f %11.0f %11.0f %11.0f %11.0f %6s\n", 
+	       i, "yes", s->heapsize / 1024.0, s->build * 1e6, s->save * 1e6,
+	       s->restore * 1e6, s->finish * 1e6, s->reloc * 1e6,
+	       s->moved ? "yes" : "no");
+    }
+}
+
+/*
+ * fs_count - Thread routine for the false-sharing benchmark: bump one
+ *     counter FS_INCS times
+ */
+static void *fs_count(void *ptr)
+{
+    fs_arg_t *arg = (fs_arg_t *)ptr;
+    long i;
+
+    pthread_barrier_wait(arg->start);
+    for (i = 0; i < FS_INCS; i++)
+	(*arg->counter)++;
+    return NULL;
+}
+
+/*
+ * eval_false_sharing - Allocate one counter per thread from a fresh mm
+ *     heap with mm_malloc_flags(flags), then time nthreads threads that
+ *     each increment their own. Sets *shared if any two counters ended
+ *     up on the same MM_LINE-byte line. Returns the wall time in secs.
+ */
+static double eval_false_sharing(int nthreads, int flags, int *shared)
+{
+    int i, j;
+    double start, secs;
+    pthread_t *tids;
+    fs_arg_t *args;
+    pthread_barrier_t barrier;
+
+    if ((tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t))) == NULL ||
+	(args = (fs_arg_t *)calloc(nthreads, sizeof(fs_arg_t))) == NULL)
+	unix_error("calloc in eval_false_sharing failed");
+
+    reset_heap();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_false_sharing");
+    *shared = 0;
+    for (i = 0; i < nthreads; i++) {
+	args[i].counter = mm_malloc_flags(sizeof(long), flags);
+	if (args[i].counter == NULL)
+	    app_error("mm_malloc_flags failed in eval_false_sharing");
+	*args[i].counter = 0;
+	for (j = 0; j < i; j++)
+	    if ((uintptr_t)args[i].counter / MM_LINE == 
+		(uintptr_t)args[j].counter / MM_LINE)
+		*shared = 1;
+    }
+
+    pthread_barrier_init(&barrier, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+	args[i].start = &barrier;
+	if (pthread_create(&tids[i], NULL, fs_count, &args[i]) != 0)
+	    unix_error("pthread_create in eval_false_sharing failed");
+    }
+    pthread_barrier_wait(&barrier);
+    start = wall_secs();
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    secs = wall_secs() - start;
+    pthread_barrier_destroy(&barrier);
+
+    for (i = 0; i < nthreads; i++)
+	mm_free((void *)args[i].counter);
+    free(args);
+    free(tids);
+    return secs;
+}
+
+/**********************************************************************
+ * The following functions time each individual request of a trace 
+ * with the raw tick counter and keep latency histograms, so that the
+ * trace lines that cause latency spikes can be found.
+ **********************************************************************/
+
+/*
+ * size_class - map a request size to its latency size class
+ */
+static int size_class(size_t size)
+{
+    int c = 0;
+
+    while (size > 16 && c < LAT_CLASSES - 1) {
+	size = (size + 1) >> 1;
+	c++;
+    }
+    return c;
+}
+
+/*
+ * record_latency - add one timed request to the histograms and keep
+ *     it if it is among the LAT_OUTLIERS slowest seen so far
+ */
+static void record_latency(latency_t *lat, int type, size_t size, 
+			   int opnum, hist_val_t ticks)
+{
+    int pos;
+
+    /* callocs are counted as mallocs */
+    if (type == CALLOC)
+	type = ALLOC;
+    hist_record(&lat->hists[type][size_class(size)], ticks);
+
+    if (lat->nslowest < LAT_OUTLIERS)
+	pos = lat->nslowest++;
+    else if (ticks > lat->slowest[LAT_OUTLIERS-1].ticks)
+	pos = LAT_OUTLIERS-1;
+    else
+	return;
+    /* Insertion sort, slowest first */
+    while (pos > 0 && lat->slowest[pos-1].ticks < ticks) {
+	lat->slowest[pos] = lat->slowest[pos-1];
+	pos--;
+    }
+    lat->slowest[pos].opnum = opnum;
+    lat->slowest[pos].ticks = ticks;
+}
+
+/*
+ * eval_latency - Replay a trace against libc malloc (libc != 0) or the
+ *     mm package, timing every request. The overhead of reading the
+ *     tick counter is measured first and subtracted from each sample.
+ */
+static void eval_latency(trace_t *trace, latency_t *lat, int libc)
+{
+    int i, j, index, size;
+    hist_val_t start, ticks, ovhd = ~0ULL;
+    char *p;
+
+    memset(lat, 0, sizeof(latency_t));
+    for (i = 0; i < 3; i++)
+	for (j = 0; j < LAT_CLASSES; j++)
+	    hist_init(&lat->hists[i][j]);
+
+    for (i = 0; i < 100; i++) {
+	start = get_ticks();
+	ticks = get_ticks() - start;
+	if (ticks < ovhd)
+	    ovhd = ticks;
+    }
+
+    if (!libc) {
+	reset_heap();
+	if (mm_init() < 0)
+	    app_error("mm_init failed in eval_latency");
+    }
 
     for (i = 0;  i < trace->num_ops;  i++) {
-        switch (trace->ops[i].type) {
-        case ALLOC: /* malloc */
-	    index = trace->ops[i].index;
-	    size = trace->ops[i].size;
-	    if ((p = malloc(size)) == NULL)
-		unix_error("malloc failed in eval_libc_speed");
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    start = get_ticks();
+	    p = libc ? malloc(size) : mm_malloc(size);
+	    ticks = get_ticks() - start;
+	    if (p == NULL)
+		app_error("malloc failed in eval_latency");
 	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
 
-	case REALLOC: /* realloc */
-	    index = trace->ops[i].index;
-	    newsize = trace->ops[i].size;
-	    oldp = trace->blocks[index];
-	    if ((newp = realloc(oldp, newsize)) == NULL)
-		unix_error("realloc failed in eval_libc_speed\n");
-	    
-	    trace->blocks[index] = newp;
+	case CALLOC:
+	    start = get_ticks();
+	    p = libc ? calloc(1, size) : mm_calloc(1, size);
+	    ticks = get_ticks() - start;
+	    if (p == NULL)
+		app_error("calloc failed in eval_latency");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
 	    break;
-	    
-        case FREE: /* free */
-	    index = trace->ops[i].index;
-	    block = trace->blocks[index];
-	    free(block);
+
+	case REALLOC:
+	    start = get_ticks();
+	    p = libc ? realloc(trace->blocks[index], size) : 
+		mm_realloc(trace->blocks[index], size);
+	    ticks = get_ticks() - start;
+	    if (p == NULL)
+		app_error("realloc failed in eval_latency");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+	case FREE:
+	    size = trace->block_sizes[index];
+	    start = get_ticks();
+	    if (libc)
+		free(trace->blocks[index]);
+	    else
+		mm_free(trace->blocks[index]);
+	    ticks = get_ticks() - start;
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_latency");
+	    return;
+	}
+	record_latency(lat, trace->ops[i].type, size, i, 
+		       ticks > ovhd ? ticks - ovhd : 0);
+    }
+}
+
+/*
+ * print_latency - print latency percentiles per request type, overall 
+ *     and by size class, followed by the trace lines of the slowest 
+ *     requests
+ */
+static void print_latency(char *name, int tracenum, trace_t *trace, 
+			  latency_t *lat)
+{
+    static char *type_names[] = {"malloc", "free", "realloc"};
+    static char type_chars[] = {'a', 'f', 'r', 'c'};
+    int t, c, i;
+    char label[32];
+    hist_t all;
+    traceop_t *op;
+
+    double ns = 1e3 / mhz(0);  /* nsecs per tick */
+
+    printf("\nRequest latency in ns for %s, trace %d:\n", name, tracenum);
+    printf("%-8s%8s%9s%8s%8s%8s%8s%9s%10s\n", "op", "size", "count", 
+	   "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (t = 0; t < 3; t++) {
+	hist_init(&all);
+	for (c = 0; c < LAT_CLASSES; c++)
+	    hist_merge(&all, &lat->hists[t][c]);
+	if (all.count == 0)
+	    continue;
+
+	for (c = -1; c < LAT_CLASSES; c++) {
+	    hist_t *h = (c < 0) ? &all : &lat->hists[t][c];
+
+	    if (h->count == 0)
+		continue;
+	    if (c < 0)
+		strcpy(label, "all");
+	    else if (c == LAT_CLASSES - 1)
+		sprintf(label, ">%d", 8 << c);
+	    else
+		sprintf(label, "<=%d", 16 << c);
+	    printf("%-8s%8s%9llu%8.0f%8.0f%8.0f%8.0f%9.0f%10.0f\n",
+		   c < 0 ? type_names[t] : "",
+		   label,
+		   h->count,
+		   hist_mean(h) * ns,
+		   hist_percentile(h, 0.50) * ns,
+		   hist_percentile(h, 0.90) * ns,
+		   hist_percentile(h, 0.99) * ns,
+		   hist_percentile(h, 0.999) * ns,
+		   h->max * ns);
+	}
+    }
+
+    printf("Slowest requests:\n");
+    for (i = 0; i < lat->nslowest; i++) {
+	op = &trace->ops[lat->slowest[i].opnum];
+	if (op->type == FREE)
+	    sprintf(label, "f %d", op->index);
+	else
+	    sprintf(label, "%c %d %d", type_chars[op->type], 
+		    op->index, op->size);
+	printf("  line %6d: %-20s %10.0f ns\n", 
+	       LINENUM(lat->slowest[i].opnum), label, 
+	       lat->slowest[i].ticks * ns);
+    }
+}
+
+/*
+ * print_events - prints the hardware events counted during one replay
+ *     of each trace, per 1000 ops, along with instructions per cycle
+ */
+static void print_events(char *name, int n, stats_t *stats, 
+			 perf_counts_t *counts)
+{
+    int i, e;
+    perf_counts_t *c;
+
+    printf("\nHardware events per 1000 ops for %s:\n", name);
+    printf("%5s", "trace");
+    for (e = 0; e < PERF_NCOUNTERS; e++)
+	printf("%11s", perf_names[e]);
+    printf("%6s\n", "IPC");
+    for (i = 0; i < n; i++) {
+	c = &counts[i];
+	printf("%2d   ", i);
+	for (e = 0; e < PERF_NCOUNTERS; e++) {
+	    if (stats[i].valid && c->valid[e])
+		printf("%11.1f", c->count[e] * 1e3 / stats[i].ops);
+	    else
+		printf("%11s", "-");
+	}
+	if (stats[i].valid && c->valid[PERF_CYCLES] && 
+	    c->valid[PERF_INSTRUCTIONS] && c->count[PERF_CYCLES] > 0)
+	    printf("%6.2f\n", 
+		   c->count[PERF_INSTRUCTIONS] / c->count[PERF_CYCLES]);
+	else
+	    printf("%6s\n", "-");
+    }
+}
+
+/**********************************************************************
+ * The following functions write the per-trace results in JSON or CSV
+ * and check them against a baseline file, so that allocator changes 
+ * can be gated on throughput, utilization and latency. A baseline is 
+ * a CSV results file that may also carry lines of the form
+ *
+ *     # tolerance <metric> <fraction>
+ *
+ * A metric with a tolerance regresses when it gets worse than its
+ * baseline value by more than that fraction of the baseline value.
+ **********************************************************************/
+
+/*
+ * store_latency - keep the latency percentiles of a replay in stats
+ */
+static void store_latency(stats_t *stats, latency_t *lat)
+{
+    static double qs[3] = {0.50, 0.99, 0.999};
+    double ns = 1e3 / mhz(0);
+    int t, c, q;
+    hist_t all;
+
+    for (t = 0; t < 3; t++) {
+	hist_init(&all);
+	for (c = 0; c < LAT_CLASSES; c++)
+	    hist_merge(&all, &lat->hists[t][c]);
+	for (q = 0; q < 3; q++)
+	    stats->lat[t][q] = hist_percentile(&all, qs[q]) * ns;
+    }
+}
+
+/*
+ * write_csv - write a CSV header line and one line per trace
+ */
+static void write_csv(FILE *fp, int n, char **tracefiles, stats_t *stats)
+{
+    int i;
+    size_t m;
+
+    fprintf(fp, "trace,valid");
+    for (m = 0; m < NUM_METRICS; m++)
+	fprintf(fp, ",%s", metrics[m].name);
+    fprintf(fp, "\n");
+    for (i = 0; i < n; i++) {
+	fprintf(fp, "%s,%d", trace_name(tracefiles[i]), stats[i].valid);
+	for (m = 0; m < NUM_METRICS; m++)
+	    fprintf(fp, ",%.6g", stats[i].valid ? 
+		    METRIC_VAL(&stats[i], &metrics[m]) : 0.0);
+	fprintf(fp, "\n");
+    }
+}
+
+/*
+ * write_results - write the results to file ("-" for stdout) as CSV if
+ *     its name ends in ".csv" and as JSON otherwise
+ */
+static void write_results(char *file, int n, char **tracefiles, 
+			  stats_t *stats, double perfindex)
+{
+    FILE *fp;
+    int i;
+    size_t m, len = strlen(file);
+
+    if (!strcmp(file, "-"))
+	fp = stdout;
+    else if ((fp = fopen(file, "w")) == NULL)
+	unix_error("Could not open the -o file");
+
+    if (len > 4 && !strcmp(file + len - 4, ".csv")) {
+	write_csv(fp, n, tracefiles, stats);
+    } 
+    else {
+	fprintf(fp, "{\n  \"perf_index\": %.2f,\n  \"traces\": [\n", 
+		perfindex);
+	for (i = 0; i < n; i++) {
+	    fprintf(fp, "    {\"trace\": \"%s\", \"valid\": %s", 
+		    trace_name(tracefiles[i]), 
+		    stats[i].valid ? "true" : "false");
+	    for (m = 0; stats[i].valid && m < NUM_METRICS; m++)
+		fprintf(fp, ", \"%s\": %.6g", metrics[m].name, 
+			METRIC_VAL(&stats[i], &metrics[m]));
+	    fprintf(fp, "}%s\n", i < n - 1 ? "," : "");
+	}
+	fprintf(fp, "  ]\n}\n");
+    }
+
+    if (fp != stdout)
+	fclose(fp);
+}
+
+/*
+ * write_baseline - write the results as CSV, preceded by the default
+ *     tolerances, for a later -b run to check against
+ */
+static void write_baseline(char *file, int n, char **tracefiles, 
+			   stats_t *stats)
+{
+    FILE *fp;
+    size_t m;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	unix_error("Could not open the -W file");
+    fprintf(fp, "# mdriver baseline\n");
+    for (m = 0; m < NUM_METRICS; m++)
+	if (metrics[m].tol > 0)
+	    fprintf(fp, "# tolerance %s %g\n", metrics[m].name, 
+		    metrics[m].tol);
+    write_csv(fp, n, tracefiles, stats);
+    fclose(fp);
+}
+
+/*
+ * split_csv - split line in place at commas and strip the newline. 
+ *     Returns the number of fields stored in fields.
+ */
+static int split_csv(char *line, char **fields, int max)
+{
+    int n = 0;
+    char *p = line;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    while (n < max) {
+	fields[n++] = p;
+	if ((p = strchr(p, ',')) == NULL)
 	    break;
+	*p++ = '\0';
+    }
+    return n;
+}
+
+/*
+ * check_baseline - compare each valid trace's metrics with the matching
+ *     row of the baseline and report every metric that got worse than
+ *     its tolerance allows. Returns the number of regressions.
+ */
+static int check_baseline(char *file, int n, char **tracefiles, 
+			  stats_t *stats)
+{
+    FILE *fp;
+    char line[MAXLINE], name[MAXLINE];
+    char *header[NUM_METRICS + 2], *fields[NUM_METRICS + 2];
+    char hdrline[MAXLINE];
+    double tol[NUM_METRICS], base, cur, worse;
+    int nhdr = 0, nfields, i, f, regressions = 0;
+    size_t m;
+
+    for (m = 0; m < NUM_METRICS; m++)
+	tol[m] = 0;
+    if ((fp = fopen(file, "r")) == NULL)
+	unix_error("Could not open the -b file");
+
+    printf("\nChecking against baseline %s:\n", file);
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (line[0] == '#') {
+	    if (sscanf(line, "# tolerance %s %lf", name, &base) != 2)
+		continue;
+	    for (m = 0; m < NUM_METRICS; m++)
+		if (!strcmp(metrics[m].name, name))
+		    tol[m] = base;
+	    continue;
+	}
+	if (nhdr == 0) {
+	    strcpy(hdrline, line);
+	    nhdr = split_csv(hdrline, header, NUM_METRICS + 2);
+	    continue;
+	}
+
+	nfields = split_csv(line, fields, NUM_METRICS + 2);
+	for (i = 0; i < n; i++)
+	    if (!strcmp(fields[0], trace_name(tracefiles[i])))
+		break;
+	if (i == n || nfields < 2 || !atoi(fields[1]))
+	    continue;
+	if (!stats[i].valid) {
+	    printf("  %s: no longer valid\n", fields[0]);
+	    regressions++;
+	    continue;
+	}
+
+	for (f = 2; f < nfields && f < nhdr; f++) {
+	    for (m = 0; m < NUM_METRICS; m++)
+		if (!strcmp(metrics[m].name, header[f]))
+		    break;
+	    if (m == NUM_METRICS || tol[m] <= 0 || metrics[m].better == 0)
+		continue;
+	    base = atof(fields[f]);
+	    cur = METRIC_VAL(&stats[i], &metrics[m]);
+	    if (base == 0)
+		continue;
+	    worse = metrics[m].better * (base - cur) / base;
+	    if (worse > tol[m]) {
+		printf("  %s: %s regressed from %.6g to %.6g "
+		       "(%.1f%% worse, tolerance %.1f%%)\n",
+		       fields[0], metrics[m].name, base, cur, 
+		       100.0 * worse, 100.0 * tol[m]);
+		regressions++;
+	    }
 	}
     }
+    fclose(fp);
+
+    if (regressions)
+	printf("%d regressions\n", regressions);
+    else
+	printf("No regressions\n");
+    return regressions;
 }
 
 /*************************************
@@ -918,22 +3474,36 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double warm = 0, cold = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    if (cache_modes)
+	printf("(warm runs follow one untimed run; cold runs follow a flush "
+	       "of %lu KB, twice the LLC)\n", 
+	       (unsigned long)fsecs_llc_bytes() * 2 / 1024);
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (cache_modes)
+	printf("%7s%7s", "warm", "cold");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d %10s %5.0f%% %8.0f %10.6f %6.0f\n", 
+	    printf("%2d %10s %5.0f%% %8.0f %10.6f %6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (cache_modes)
+		printf(" %6.0f %6.0f", (stats[i].ops/1e3)/stats[i].warm_secs,
+		       (stats[i].ops/1e3)/stats[i].cold_secs);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    warm += stats[i].warm_secs;
+	    cold += stats[i].cold_secs;
 	}
 	else {
 	    printf("%2d %10s %6s %8s %10s %6s\n", 
@@ -948,12 +3518,15 @@ static void printresults(int n, stats_t *stats)
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	if (cache_modes)
+	    printf(" %6.0f %6.0f", (ops/1e3)/warm, (ops/1e3)/cold);
+	printf("\n");
     }
     else {
 	printf("%12s%6s%8s%10s%6s\n", 
@@ -966,6 +3539,161 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * print_mt_results - prints the aggregate throughput, the scaling 
+ *     efficiency relative to one thread, and the sampled tail latency
+ *     of a multi-threaded replay for each trace and thread count
+ */
+static void print_mt_results(char *name, int ntraces, int ncounts,
+			     mtstats_t *stats)
+{
+    int i, c;
+    double kops, base;
+    mtstats_t *s;
+
+    printf("\nMulti-threaded replay for %s:\n", name);
+    printf("(%d passes per thread, \"-\" marks a request that failed)\n",
+	   THREAD_REPS);
+    printf("%5s%8s%10s%7s%10s%10s%10s\n", 
+	   "trace", "threads", "Kops", "eff", "p50(us)", "p99(us)", "p999(us)");
+    for (i = 0; i < ntraces; i++) {
+	base = 0;
+	for (c = 0; c < ncounts; c++) {
+	    s = &stats[i*ncounts + c];
+	    if (!s->valid) {
+		printf("%2d %9d %9s %6s %9s %9s %9s\n", 
+		       i, s->nthreads, "-", "-", "-", "-", "-");
+		continue;
+	    }
+	    kops = (s->ops/1e3)/s->secs;
+	    if (s->nthreads == 1)
+		base = kops;
+	    printf("%2d %9d %9.0f %5.0f%% %9.3f %9.3f %9.3f\n", 
+		   i,
+		   s->nthreads,
+		   kops,
+		   base > 0 ? 100.0 * kops/(base * s->nthreads) : 0.0,
+		   s->p50 * 1e6,
+		   s->p99 * 1e6,
+		   s->p999 * 1e6);
+	}
+    }
+}
+
+/*
+ * print_bench_results - prints the median run time of each trace with
+ *     its spread and its 95% confidence interval
+ */
+static void print_bench_results(int n, stats_t *stats, 
+				bench_result_t *results)
+{
+    int i;
+    bench_result_t *r;
+
+    printf("\nBenchmark results for mm malloc (95%% CI of the median):\n");
+    printf("%5s%8s%12s%12s%12s%12s%7s%8s\n", "trace", "samples",
+	   "median(s)", "MAD(s)", "CI low", "CI high", "+/-", "Kops");
+    for (i = 0; i < n; i++) {
+	r = &results[i];
+	if (!stats[i].valid) {
+	    printf("%2d %10s\n", i, "-");
+	    continue;
+	}
+	printf("%2d %10d %11.6f %11.6f %11.6f %11.6f %5.1f%% %7.0f\n",
+	       i,
+	       r->n,
+	       r->median,
+	       r->mad,
+	       r->ci_lo,
+	       r->ci_hi,
+	       100.0 * (r->ci_hi - r->ci_lo) / 2 / r->median,
+	       (stats[i].ops/1e3)/r->median);
+    }
+}
+
+/*
+ * trace_name - the file name part of a trace path, used to match up
+ *     traces between runs that were given different trace directories
+ */
+static char *trace_name(char *path)
+{
+    char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+/*
+ * save_bench_results - save the samples of every valid trace
+ */
+static void save_bench_results(char *file, int n, char **tracefiles,
+			       stats_t *stats, bench_result_t *results)
+{
+    FILE *fp;
+    int i;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	unix_error("Could not open the -S file");
+    for (i = 0; i < n; i++)
+	if (stats[i].valid)
+	    bench_write(fp, trace_name(tracefiles[i]), &results[i]);
+    fclose(fp);
+}
+
+/*
+ * compare_bench_results - test each trace's samples against the ones 
+ *     saved in file by an earlier run, e.g. of another build of mm.c.
+ *     A trace changed only if the 95% CIs of its medians don't overlap
+ *     and the medians are at least min_effect apart.
+ */
+static void compare_bench_results(char *file, int n, char **tracefiles,
+				  stats_t *stats, bench_result_t *results,
+				  double min_effect)
+{
+    FILE *fp;
+    int i, rc, verdict;
+    int nbase = 0;
+    char names[64][MAXLINE];
+    bench_result_t base[64];
+    double change;
+
+    if ((fp = fopen(file, "r")) == NULL)
+	unix_error("Could not open the -X file");
+    while (nbase < 64 && 
+	   (rc = bench_read(fp, names[nbase], MAXLINE, &base[nbase])) == 1)
+	nbase++;
+    fclose(fp);
+    if (rc < 0)
+	app_error("Malformed benchmark file given to -X");
+
+    printf("\nComparison against %s (95%% CIs of the medians, "
+	   "minimum change %.1f%%):\n", file, 100.0 * min_effect);
+    printf("%5s%12s%8s%12s%8s%9s  %s\n", 
+	   "trace", "base(s)", "+/-", "this(s)", "+/-", "change", "verdict");
+    for (i = 0; i < n; i++) {
+	for (rc = 0; rc < nbase; rc++)
+	    if (!strcmp(names[rc], trace_name(tracefiles[i])))
+		break;
+	if (!stats[i].valid || rc == nbase) {
+	    printf("%2d %11s %7s %11s %7s %8s  %s\n", i, "-", "-", "-", "-", "-",
+		   stats[i].valid ? "not in baseline" : "invalid");
+	    continue;
+	}
+	verdict = bench_compare(&base[rc], &results[i], min_effect, &change);
+	printf("%2d %11.6f %6.1f%% %11.6f %6.1f%% %7.1f%%  %s\n",
+	       i,
+	       base[rc].median,
+	       50.0 * (base[rc].ci_hi - base[rc].ci_lo) / base[rc].median,
+	       results[i].median,
+	       50.0 * (results[i].ci_hi - results[i].ci_lo) / results[i].median,
+	       100.0 * change,
+	       verdict == 0 ? "no significant change" : 
+	       verdict < 0 ? "significantly faster" : "significantly slower");
+    }
+
+    for (i = 0; i < nbase; i++)
+	bench_free(&base[i]);
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -984,6 +3712,67 @@ void unix_error(char *msg)
     exit(1);
 }
 
+/*
+ * wall_secs - Return the current value of a monotonic wall clock in secs
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+/*
+ * write_all - Write len bytes to fd. Returns 0, or -1 on error
+ */
+static int write_all(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = write(fd, buf, len)) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf = (char *)buf + n;
+	len -= n;
+    }
+    return 0;
+}
+
+/*
+ * read_all - Read exactly len bytes from fd. Returns 0, or -1 on error 
+ *     or end of file
+ */
+static int read_all(int fd, void *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = read(fd, buf, len)) <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    return -1;
+	}
+	buf = (char *)buf + n;
+	len -= n;
+    }
+    return 0;
+}
+
+/*
+ * cmp_double - qsort comparison function for an array of doubles
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
@@ -998,13 +3787,47 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValAHBesTZ] [-f <file>] [-t <dir>] [-P <n>]\n"
+	    "               [-C <cpu>] [-S <file>] [-X <file>] [-E <pct>]\n"
+	    "               [-o <file>] [-b <file>] [-W <file>] [-a <n>] [-k <mode>] [-m <MB>]\n"
+	    "               [-j <n>] [-F <n>] [-d <ms>] [-R <file>] [-M <n>]\n"
+	    "               [-p <bytes>] [-x <pat>]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-a <n>     Print the shape of the mm heap every <n> requests.\n");
+    fprintf(stderr, "\t-A         Also replay each trace through movable handles, compacting.\n");
+    fprintf(stderr, "\t-b <file>  Exit non-zero if results regress against baseline <file>.\n");
+    fprintf(stderr, "\t-B         Time mm adaptively, reporting medians and 95%% CIs.\n");
+    fprintf(stderr, "\t-C <cpu>   Pin the driver to CPU <cpu>.\n");
+    fprintf(stderr, "\t-d <ms>    Purge free pages unused for <ms> ms, and report the purging.\n");
+    fprintf(stderr, "\t-E <pct>   Make -X report only changes of at least <pct>%% (default %g).\n",
+	    100 * BENCH_MIN_EFFECT);
+    fprintf(stderr, "\t-e         Count cache, TLB and branch events with perf_event_open.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <n>     Time <n> threads bumping packed vs. line-exclusive counters.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H         Print latency percentiles for every request type.\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once in forked workers.\n");
+    fprintf(stderr, "\t-k <mode>  Check the heap after each call, \"incr\" or \"full\" (make CHECK=1).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-s         Print mm.c's statistics for each trace (make STATS=1).\n");
+    fprintf(stderr, "\t-S <file>  Save the -B samples to <file>.\n");
+    fprintf(stderr, "\t-W <file>  Write results as a baseline for -b to <file>.\n");
+    fprintf(stderr, "\t-X <file>  Test the -B samples against those saved in <file>.\n");
+    fprintf(stderr, "\t-m <MB>    Model a heap of <MB> megabytes instead of 20.\n");
+    fprintf(stderr, "\t-M <n>     Also replay a copy of each trace per process, on one shared heap.\n");
+    fprintf(stderr, "\t-o <file>  Write results as JSON, or CSV if <file> ends in .csv.\n");
+    fprintf(stderr, "\t-p <bytes> Sample allocations every ~<bytes> bytes; write mdriver-<n>.heap profiles.\n");
+    fprintf(stderr, "\t-P <n>     Also replay a copy of each trace per thread on 1..n threads.\n");
+    fprintf(stderr, "\t-R <file>  Time snapshots of the mm heap, saved to <file>.\n");
+    fprintf(stderr, "\t-T         Also time each trace with warm and with flushed (cold) caches.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-x <pat>   Replay again using payloads: w(rite), r(ead on free), s[<n>] (scan).\n");
+    fprintf(stderr, "\t-Z         Return the heap's pages to the OS before each timed run.\n");
+    fprintf(stderr, "\nBefore trusting -X, check the noise with an A/A run of one build against\n"
+	    "itself: \"mdriver -B -S a.bench\", then \"mdriver -B -X a.bench\". Every trace\n"
+	    "should show no significant change; if not, raise -E above the largest\n"
+	    "change it reports (and pin with -C).\n");
 }
@@ -1,8 +1,12 @@
 /*
- * memlib.c - a module that simulates the memory system.  Needed because it 
- *            allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.  Needed because it
+ *            allows us to interleave calls from the student's malloc package
  *            with the system's malloc package in libc.
+ *
+ * Each memlib_t models one independent heap; the mem_* functions
+ * operate on a default instance, which is what the driver uses.
  */
+#define _GNU_SOURCE  /* for memfd_create */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,86 +14,506 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* One modeled heap */
+struct memlib {
+    size_t max_heap;      /* size of the modeled VM */
+    char *start_brk;      /* points to first byte of heap */
+    char *brk;            /* points to last byte of heap */
+    char *max_addr;       /* largest legal heap address */
+    char *clean_lo;       /* bytes from here up were never handed out */
+    size_t file_len;      /* bytes at the start mapped from a file */
+    int fd;               /* memfd of a shared heap, else -1 */
+    struct memlib_shared *sh; /* its header page, in this process's mapping */
+};
+
+/*
+ * The page in front of a shared heap: the heap's brk, which every
+ * process must see, and room for the allocator's own shared state. It
+ * holds offsets rather than pointers, as the processes may map the
+ * memfd at different addresses.
+ */
+#define MEMLIB_MAGIC "memlib1"
+struct memlib_shared {
+    char magic[8];
+    size_t max_heap;      /* size of the heap, not counting this page */
+    size_t brk;           /* offsets of the brk ... */
+    size_t clean_lo;      /* ... and of the known-zero range */
+    long long area[MEMLIB_SHARED_AREA / sizeof(long long)];
+};
+
+/* pages memlib_purge asks mincore about at a time */
+#define PURGE_PAGES 256
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static memlib_t mem_default_heap = { MAX_HEAP, NULL, NULL, NULL, NULL, 0, -1, NULL };
 
-/* 
- * mem_init - initialize the memory system model
+/*
+ * memlib_map - map the storage we will use to model the available VM,
+ *    at base if that range is free (or base is NULL) and anywhere
+ *    otherwise; pages are only backed once touched, so a large heap
+ *    costs nothing up front
  */
-void mem_init(void)
+static int memlib_map(memlib_t *m, void *base)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
-	exit(1);
+    m->start_brk = (char *)mmap(base, m->max_heap, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				-1, 0);
+    if (m->start_brk == MAP_FAILED)
+	return -1;
+    m->max_addr = m->start_brk + m->max_heap;  /* max legal heap address */
+    m->brk = m->start_brk;                     /* heap is empty initially */
+    m->clean_lo = m->start_brk;                /* fresh pages read as zero */
+    m->file_len = 0;
+    m->fd = -1;
+    m->sh = NULL;
+    return 0;
+}
+
+/*
+ * memlib_create - create an independent heap of at most max_heap bytes.
+ *    Returns NULL if the storage can't be mapped.
+ */
+memlib_t *memlib_create(size_t max_heap)
+{
+    return memlib_create_at(NULL, max_heap);
+}
+
+/*
+ * memlib_create_at - the same, starting at address base if nothing is
+ *    mapped there yet (check memlib_heap_lo to see if it was)
+ */
+memlib_t *memlib_create_at(void *base, size_t max_heap)
+{
+    memlib_t *m;
+
+    if ((m = (memlib_t *)malloc(sizeof(memlib_t))) == NULL)
+	return NULL;
+    m->max_heap = max_heap;
+    if (memlib_map(m, base) < 0) {
+	free(m);
+	return NULL;
     }
+    return m;
+}
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+/*
+ * memlib_destroy - release a heap made by memlib_create
+ */
+void memlib_destroy(memlib_t *m)
+{
+    if (m->sh != NULL) {
+	munmap(m->sh, mem_pagesize() + m->max_heap);
+	close(m->fd);
+    }
+    else
+	munmap(m->start_brk, m->max_heap);
+    free(m);
 }
 
-/* 
- * mem_deinit - free the storage used by the memory system model
+/*
+ * memlib_map_shared - map the memfd of a shared heap: its header page,
+ *    then the heap. Returns -1 if it can't be mapped or isn't one.
  */
-void mem_deinit(void)
+static int memlib_map_shared(memlib_t *m, int fd)
+{
+    size_t page = mem_pagesize();
+    struct stat st;
+    char *p;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size <= page)
+	return -1;
+    p = (char *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, 
+		     MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (p == MAP_FAILED)
+	return -1;
+    m->fd = fd;
+    m->sh = (struct memlib_shared *)p;
+    m->max_heap = st.st_size - page;
+    m->start_brk = p + page;
+    m->max_addr = m->start_brk + m->max_heap;
+    m->file_len = 0;
+    if (memcmp(m->sh->magic, MEMLIB_MAGIC, sizeof(m->sh->magic)) != 0 ||
+	m->sh->max_heap != m->max_heap) {
+	munmap(p, st.st_size);
+	return -1;
+    }
+    memlib_sync_in(m);
+    return 0;
+}
+
+/*
+ * memlib_create_shared - create a heap of at most max_heap bytes in a
+ *    new memfd. Child processes inherit it; others can map it with
+ *    memlib_attach, given the fd (see memlib_fd). Its brk is shared, so
+ *    call memlib_sync_in before using a heap another process may have
+ *    changed, and memlib_sync_out after, all under one lock (mm_lock_h).
+ *    Returns NULL if the memfd can't be made.
+ */
+memlib_t *memlib_create_shared(size_t max_heap)
 {
-    free(mem_start_brk);
+    size_t page = mem_pagesize();
+    struct memlib_shared init;
+    memlib_t *m;
+    int fd;
+
+    if (sizeof(struct memlib_shared) > page)
+	return NULL;
+    if ((m = (memlib_t *)malloc(sizeof(memlib_t))) == NULL)
+	return NULL;
+    memset(&init, 0, sizeof(init));
+    memcpy(init.magic, MEMLIB_MAGIC, sizeof(init.magic));
+    init.max_heap = max_heap;
+    if ((fd = memfd_create("memlib", 0)) < 0) {
+	free(m);
+	return NULL;
+    }
+    if (ftruncate(fd, page + max_heap) < 0 ||
+	pwrite(fd, &init, sizeof(init), 0) != sizeof(init) ||
+	memlib_map_shared(m, fd) < 0) {
+	close(fd);
+	free(m);
+	return NULL;
+    }
+    return m;
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * memlib_attach - map the shared heap in memfd fd, which the memlib
+ *    takes over. Returns NULL if fd doesn't hold one.
  */
-void mem_reset_brk()
+memlib_t *memlib_attach(int fd)
+{
+    memlib_t *m;
+
+    if ((m = (memlib_t *)malloc(sizeof(memlib_t))) == NULL)
+	return NULL;
+    if (memlib_map_shared(m, fd) < 0) {
+	free(m);
+	return NULL;
+    }
+    return m;
+}
+
+/*
+ * memlib_fd - the memfd behind a shared heap, or -1
+ */
+int memlib_fd(memlib_t *m)
+{
+    return m->fd;
+}
+
+/*
+ * memlib_shared_area - MEMLIB_SHARED_AREA bytes of zero-initialized
+ *    memory that every process using a shared heap sees, or NULL if the
+ *    heap isn't shared
+ */
+void *memlib_shared_area(memlib_t *m)
+{
+    return (m->sh != NULL) ? (void *)m->sh->area : NULL;
+}
+
+/*
+ * memlib_sync_in - pick up the brk of a shared heap as the other
+ *    processes left it
+ */
+void memlib_sync_in(memlib_t *m)
+{
+    if (m->sh != NULL) {
+	m->brk = m->start_brk + m->sh->brk;
+	m->clean_lo = m->start_brk + m->sh->clean_lo;
+    }
+}
+
+/*
+ * memlib_sync_out - publish this process's brk of a shared heap
+ */
+void memlib_sync_out(memlib_t *m)
+{
+    if (m->sh != NULL) {
+	m->sh->brk = m->brk - m->start_brk;
+	m->sh->clean_lo = m->clean_lo - m->start_brk;
+    }
+}
+
+/*
+ * memlib_max_heap - the most bytes the heap can grow to
+ */
+size_t memlib_max_heap(memlib_t *m)
+{
+    return m->max_heap;
+}
+
+/*
+ * memlib_reset_brk - reset the simulated brk pointer to make an empty heap
+ */
+void memlib_reset_brk(memlib_t *m)
 {
-    mem_brk = mem_start_brk;
+    m->brk = m->start_brk;
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+/*
+ * memlib_release - reset the brk pointer and give the heap's pages back
+ *    to the OS, so the whole heap reads as zero again, like a new
+ *    process's (at the price of faulting the pages back in)
  */
-void *mem_sbrk(int incr) 
+void memlib_release(memlib_t *m)
 {
-    char *old_brk = mem_brk;
+    char *hi = m->clean_lo;
+
+    /* Dropped pages of a file mapping would read back from the file,
+       so put fresh anonymous memory in its place instead; a memfd's
+       pages have to be punched out of the file itself */
+    if (m->sh != NULL) {
+	if (hi > m->start_brk &&
+	    madvise(m->start_brk, hi - m->start_brk, MADV_REMOVE) == 0)
+	    m->clean_lo = m->start_brk;
+    }
+    else if (m->file_len > 0) {
+	if (m->start_brk + m->file_len > hi)
+	    hi = m->start_brk + m->file_len;
+	if (mmap(m->start_brk, hi - m->start_brk, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		 -1, 0) != MAP_FAILED) {
+	    m->file_len = 0;
+	    m->clean_lo = m->start_brk;
+	}
+    }
+    else if (hi > m->start_brk &&
+	     madvise(m->start_brk, hi - m->start_brk, MADV_DONTNEED) == 0)
+	m->clean_lo = m->start_brk;
+    m->brk = m->start_brk;
+}
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+/*
+ * memlib_map_file - make the heap the len bytes of file fd at offset off
+ *    (a multiple of the page size). The file is mapped copy-on-write, so
+ *    its pages are read in as the heap touches them and writes never
+ *    reach the file. Returns -1 if the file can't be mapped, the heap
+ *    can't hold it, or the heap is shared.
+ */
+int memlib_map_file(memlib_t *m, int fd, off_t off, size_t len)
+{
+    if (len > m->max_heap || m->sh != NULL)
+	return -1;
+    if (len > 0 && mmap(m->start_brk, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, off) == MAP_FAILED)
+	return -1;
+    m->brk = m->start_brk + len;
+    if (m->brk > m->clean_lo)
+	m->clean_lo = m->brk;
+    if (len > m->file_len)
+	m->file_len = len;
+    return 0;
+}
+
+/*
+ * private_pages - count the pages in [lo, lo + len), at most PURGE_PAGES
+ *    of them, that hold the process's own copy of a file mapping's page.
+ *    mincore can't tell those from clean pages of the page cache, which
+ *    stay resident when the mapping goes, so ask /proc/self/pagemap: a
+ *    present page that isn't a file page. Counts none if it can't.
+ */
+static size_t private_pages(char *lo, size_t len)
+{
+    size_t page = (size_t)getpagesize(), n = len / page, i, count = 0;
+    uint64_t ent[PURGE_PAGES];
+    int fd;
+
+    if ((fd = open("/proc/self/pagemap", O_RDONLY)) < 0)
+	return 0;
+    if (pread(fd, ent, n * sizeof(ent[0]), 
+	      (off_t)((uintptr_t)lo / page * sizeof(ent[0]))) 
+	== (ssize_t)(n * sizeof(ent[0]))) {
+	for (i = 0; i < n; i++)
+	    if ((ent[i] >> 63) & 1 && !((ent[i] >> 61) & 1))
+		count++;
+    }
+    close(fd);
+    return count;
+}
+
+/*
+ * memlib_purge - give the whole pages within [lo, hi) back to the OS;
+ *    they read as zero when next touched. Returns the bytes of resident
+ *    memory released, 0 if the range holds no whole page or lies
+ *    outside the heap. Stretches with no resident page are skipped, so
+ *    purging a range twice costs little and isn't counted twice.
+ */
+size_t memlib_purge(memlib_t *m, void *lo, void *hi)
+{
+    size_t page = (size_t)getpagesize(), len, i, resident, released = 0;
+    char *plo = (char *)(((size_t)lo + page - 1) & ~(page - 1));
+    char *phi = (char *)((size_t)hi & ~(page - 1));
+    char *file_hi = (char *)(((size_t)m->start_brk + m->file_len + page - 1)
+			     & ~(page - 1));
+    unsigned char vec[PURGE_PAGES];
+
+    if ((char *)lo < m->start_brk || (char *)hi > m->brk)
+	return 0;
+    for (; plo < phi; plo += len) {
+	len = (size_t)(phi - plo);
+	if (len > PURGE_PAGES * page)
+	    len = PURGE_PAGES * page;
+
+	/* As in memlib_release, dropped pages of a file mapping would
+	   read back from the file, so map fresh anonymous memory over
+	   them, whether resident or not */
+	if (plo < file_hi) {
+	    if (plo + len > file_hi)
+		len = (size_t)(file_hi - plo);
+	    resident = private_pages(plo, len);
+	    if (mmap(plo, len, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+		     -1, 0) != MAP_FAILED)
+		released += resident * page;
+	    continue;
+	}
+	if (mincore(plo, len, vec) < 0)
+	    return released;
+	for (i = 0, resident = 0; i < len / page; i++)
+	    resident += vec[i] & 1;
+	if (resident > 0 && 
+	    madvise(plo, len, m->sh ? MADV_REMOVE : MADV_DONTNEED) == 0)
+	    released += resident * page;
+    }
+    return released;
+}
+
+/*
+ * memlib_sbrk - simple model of the sbrk function. Extends the heap
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, and the whole pages past the new
+ *    brk go back to the OS.
+ */
+void *memlib_sbrk(memlib_t *m, int incr)
+{
+    char *old_brk = m->brk;
+
+    if (incr < 0 && m->brk + incr >= m->start_brk) {
+	memlib_purge(m, m->brk + incr, m->brk);
+	m->brk += incr;
+	return (void *)old_brk;
+    }
+    if ( (incr < 0) || ((m->brk + incr) > m->max_addr)) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    m->brk += incr;
+    if (m->brk > m->clean_lo)
+	m->clean_lo = m->brk;
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * memlib_heap_lo - return address of the first heap byte
  */
-void *mem_heap_lo()
+void *memlib_heap_lo(memlib_t *m)
 {
-    return (void *)mem_start_brk;
+    return (void *)m->start_brk;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * memlib_heap_hi - return address of last heap byte
  */
-void *mem_heap_hi()
+void *memlib_heap_hi(memlib_t *m)
+{
+    return (void *)(m->brk - 1);
+}
+
+/*
+ * memlib_clean_lo - lowest address of the "known-zero" range: the heap
+ *    has never reached past it, so everything from there to the end of
+ *    the modeled VM still reads as zero
+ */
+void *memlib_clean_lo(memlib_t *m)
+{
+    return (void *)m->clean_lo;
+}
+
+/*
+ * memlib_heapsize() - returns the heap size in bytes
+ */
+size_t memlib_heapsize(memlib_t *m)
 {
-    return (void *)(mem_brk - 1);
+    return (size_t)(m->brk - m->start_brk);
 }
 
+/***********************************************************
+ * The default instance, used through the original mem_* API
+ ***********************************************************/
+
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_init - initialize the memory system model
  */
-size_t mem_heapsize() 
+void mem_init(void)
+{
+    if (memlib_map(&mem_default_heap, NULL) < 0) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+}
+
+/*
+ * mem_deinit - free the storage used by the memory system model
+ */
+void mem_deinit(void)
+{
+    munmap(mem_default_heap.start_brk, mem_default_heap.max_heap);
+}
+
+/*
+ * mem_set_max_heap - set the size of the modeled VM (default MAX_HEAP);
+ *    call before mem_init
+ */
+void mem_set_max_heap(size_t bytes)
+{
+    mem_default_heap.max_heap = bytes;
+}
+
+/*
+ * mem_default - the instance behind the mem_* functions
+ */
+memlib_t *mem_default(void)
+{
+    return &mem_default_heap;
+}
+
+void mem_reset_brk()
+{
+    memlib_reset_brk(&mem_default_heap);
+}
+
+void mem_release(void)
+{
+    memlib_release(&mem_default_heap);
+}
+
+void *mem_sbrk(int incr)
+{
+    return memlib_sbrk(&mem_default_heap, incr);
+}
+
+void *mem_heap_lo()
+{
+    return memlib_heap_lo(&mem_default_heap);
+}
+
+void *mem_heap_hi()
+{
+    return memlib_heap_hi(&mem_default_heap);
+}
+
+size_t mem_heapsize()
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return memlib_heapsize(&mem_default_heap);
 }
 
 /*
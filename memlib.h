@@ -1,11 +1,40 @@
 #include <unistd.h>
 
-void mem_init(void);               
+/* An independent modeled heap */
+typedef struct memlib memlib_t;
+
+memlib_t *memlib_create(size_t max_heap);
+memlib_t *memlib_create_at(void *base, size_t max_heap);
+void memlib_destroy(memlib_t *m);
+size_t memlib_max_heap(memlib_t *m);
+void *memlib_sbrk(memlib_t *m, int incr);
+void memlib_reset_brk(memlib_t *m);
+void memlib_release(memlib_t *m);
+size_t memlib_purge(memlib_t *m, void *lo, void *hi);
+int memlib_map_file(memlib_t *m, int fd, off_t off, size_t len);
+void *memlib_heap_lo(memlib_t *m);
+void *memlib_heap_hi(memlib_t *m);
+void *memlib_clean_lo(memlib_t *m);
+size_t memlib_heapsize(memlib_t *m);
+
+/* A heap in a memfd that several processes map at once */
+#define MEMLIB_SHARED_AREA 2048	/* bytes for the allocator's shared state */
+memlib_t *memlib_create_shared(size_t max_heap);
+memlib_t *memlib_attach(int fd);
+int memlib_fd(memlib_t *m);
+void *memlib_shared_area(memlib_t *m);
+void memlib_sync_in(memlib_t *m);
+void memlib_sync_out(memlib_t *m);
+
+/* The same, for the default instance */
+void mem_init(void);
 void mem_deinit(void);
+void mem_set_max_heap(size_t bytes);
+memlib_t *mem_default(void);
 void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void mem_reset_brk(void);
+void mem_release(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
-
@@ -0,0 +1,290 @@
+/*
+ * mkbuckets.c - Derive mm.c's segregated free list boundaries from traces
+ *
+ * Reads a set of trace files, histograms the block sizes mm_malloc and
+ * mm_realloc would ask for, and writes the header mm_buckets.h that
+ * mm.c compiles in as its size class table:
+ *
+ *   unix> ./mkbuckets traces/amptjp-bal.rep ... > mm_buckets.h
+ *
+ * "make buckets" does this for all balanced traces in traces/.
+ *
+ * Block sizes up to BUCKET_SMALL_MAX get individually placed boundaries
+ * and an O(1) lookup array; larger, rarer sizes fall into coarse
+ * power-of-two bins.
+ *
+ * The small boundaries come from a dynamic program over the histogram
+ * that minimizes a simple model of the cost of a request of size s
+ * landing in a list whose blocks are distributed like the requests
+ * that map to the same list:
+ *
+ *   probes(s) = fraction of the list's blocks smaller than s, which
+ *               first fit has to step over, and
+ *   waste(s)  = expected (t - s) / s over the blocks t > s that would
+ *               be split (or, for small leftovers, wasted) to fit s.
+ *
+ * A list that holds a single hot size costs nothing: the first block
+ * fits exactly.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <unistd.h>
+
+#define ALIGNMENT 8
+#define DSIZE 8
+#define MINSIZE 24		/* Must match mm.c */
+#define MAXLINE 1024
+
+#define DEF_LISTS 20		/* Total number of segregated lists */
+#define DEF_SMALL_MAX 1024	/* Largest block size with a tuned list */
+#define MAX_LISTS 64		/* heapstat.c tracks at most 64 buckets */
+
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+
+static int nsizes;		/* Number of block sizes MINSIZE..small_max */
+static double *count;		/* count[i] = requests of block size MINSIZE+8i */
+static double large;		/* Requests for blocks above small_max */
+
+static void usage(void);
+static void unix_error(char *msg);
+static size_t block_size(size_t size);
+static void read_trace(char *filename, size_t small_max);
+static double interval_cost(int lo, int hi);
+static void tune(int nsmall, int *last);
+
+/*
+ * block_size - The block size mm_malloc would carve out for a request
+ */
+static size_t block_size(size_t size)
+{
+    if (size <= 2 * DSIZE)
+	return MINSIZE;
+    return ALIGN(size) + DSIZE;
+}
+
+/*
+ * read_trace - Add the allocation requests of one trace to the histogram
+ */
+static void read_trace(char *filename, size_t small_max)
+{
+    FILE *fp;
+    char line[MAXLINE], type[MAXLINE];
+    unsigned int index, size;
+    size_t bsize;
+
+    if ((fp = fopen(filename, "r")) == NULL) {
+	fprintf(stderr, "mkbuckets: could not open %s\n", filename);
+	exit(1);
+    }
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	if (sscanf(line, "%s %u %u", type, &index, &size) != 3 ||
+	    (type[0] != 'a' && type[0] != 'r' && type[0] != 'c'))
+	    continue;
+	bsize = block_size(size);
+	if (bsize > small_max)
+	    large++;
+	else
+	    count[(bsize - MINSIZE) / ALIGNMENT]++;
+    }
+    fclose(fp);
+}
+
+/*
+ * interval_cost - Model cost of one list holding sizes lo..hi (indices)
+ */
+static double interval_cost(int lo, int hi)
+{
+    double n = 0, cost = 0, below = 0;
+    int i, j;
+
+    for (i = lo; i <= hi; i++)
+	n += count[i];
+    if (n == 0)
+	return 0;
+
+    for (i = lo; i <= hi; i++) {
+	double s = MINSIZE + ALIGNMENT * i, waste = 0;
+
+	if (count[i] == 0)
+	    continue;
+	for (j = i + 1; j <= hi; j++)
+	    waste += count[j] * (ALIGNMENT * (j - i)) / s;
+	cost += count[i] * (below + waste) / n;
+	below += count[i];
+    }
+    return cost;
+}
+
+/*
+ * tune - Split sizes 0..nsizes-1 into nsmall lists of minimum total cost,
+ *     returning the last size index of each list in last[]
+ */
+static void tune(int nsmall, int *last)
+{
+    double **cost, **best;
+    int **cut;
+    int i, j, k;
+
+    /* cost[i][j] for every interval, best[k][j] for k+1 lists over 0..j */
+    cost = malloc(nsizes * sizeof(double *));
+    best = malloc(nsmall * sizeof(double *));
+    cut = malloc(nsmall * sizeof(int *));
+    if (cost == NULL || best == NULL || cut == NULL)
+	unix_error("malloc failed in tune");
+    for (i = 0; i < nsizes; i++) {
+	if ((cost[i] = malloc(nsizes * sizeof(double))) == NULL)
+	    unix_error("malloc failed in tune");
+	for (j = i; j < nsizes; j++)
+	    cost[i][j] = interval_cost(i, j);
+    }
+    for (k = 0; k < nsmall; k++) {
+	best[k] = malloc(nsizes * sizeof(double));
+	cut[k] = malloc(nsizes * sizeof(int));
+	if (best[k] == NULL || cut[k] == NULL)
+	    unix_error("malloc failed in tune");
+	for (j = 0; j < nsizes; j++) {
+	    best[k][j] = (k == 0) ? cost[0][j] : DBL_MAX;
+	    cut[k][j] = -1;
+	    for (i = k - 1; k > 0 && i < j; i++) {
+		double c = best[k-1][i] + cost[i+1][j];
+		/* Ties go to the later cut, keeping the low lists narrow */
+		if (c <= best[k][j]) {
+		    best[k][j] = c;
+		    cut[k][j] = i;
+		}
+	    }
+	}
+    }
+
+    /* Walk the cuts back from the last list */
+    j = nsizes - 1;
+    for (k = nsmall - 1; k >= 0; k--) {
+	last[k] = j;
+	j = cut[k][j];
+    }
+    fprintf(stderr, "mkbuckets: model cost %.1f (probes + relative waste, "
+	    "summed over requests)\n", best[nsmall-1][nsizes-1]);
+
+    for (i = 0; i < nsizes; i++)
+	free(cost[i]);
+    for (k = 0; k < nsmall; k++) {
+	free(best[k]);
+	free(cut[k]);
+    }
+    free(cost);
+    free(best);
+    free(cut);
+}
+
+int main(int argc, char **argv)
+{
+    int lists = DEF_LISTS, nlarge, nsmall, *last;
+    size_t small_max = DEF_SMALL_MAX, limit;
+    int c, i, k;
+
+    while ((c = getopt(argc, argv, "l:s:h")) != -1) {
+	switch (c) {
+	case 'l': /* Total number of lists */
+	    lists = atoi(optarg);
+	    break;
+	case 's': /* Largest block size with its own tuned lists */
+	    small_max = atol(optarg);
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (optind == argc) {
+	usage();
+	exit(1);
+    }
+    if (lists < 2 || lists > MAX_LISTS) {
+	fprintf(stderr, "mkbuckets: -l must be between 2 and %d\n", MAX_LISTS);
+	exit(1);
+    }
+    if (small_max < 2 * MINSIZE || small_max % ALIGNMENT) {
+	fprintf(stderr, "mkbuckets: -s must be a multiple of %d, at least %d\n",
+		ALIGNMENT, 2 * MINSIZE);
+	exit(1);
+    }
+
+    /* Coarse power-of-two bins above small_max, the last one unbounded */
+    nlarge = 1;
+    for (limit = 2 * small_max; limit < ((size_t)1 << 20); limit <<= 1)
+	nlarge++;
+    if (nlarge > lists / 2)
+	nlarge = lists / 2;
+    nsmall = lists - nlarge;
+
+    nsizes = (small_max - MINSIZE) / ALIGNMENT + 1;
+    if (nsmall > nsizes) {
+	fprintf(stderr, "mkbuckets: more lists than sizes below -s\n");
+	exit(1);
+    }
+    if ((count = calloc(nsizes, sizeof(double))) == NULL ||
+	(last = malloc(nsmall * sizeof(int))) == NULL)
+	unix_error("malloc failed in main");
+    for (i = optind; i < argc; i++)
+	read_trace(argv[i], small_max);
+    tune(nsmall, last);
+
+    printf("/*\n * mm_buckets.h - Segregated list size classes for mm.c\n");
+    printf(" *\n * Generated by mkbuckets -l %d -s %lu from:\n",
+	   lists, (unsigned long)small_max);
+    for (i = optind; i < argc; i++)
+	printf(" *   %s\n", argv[i]);
+    printf(" * Do not edit; rerun \"make buckets\" instead.\n */\n");
+    printf("#define LIST_LIMT %d\n", lists);
+    printf("#define BUCKET_SMALL_MAX %lu\n\n", (unsigned long)small_max);
+
+    printf("/* Largest block size on each list; the last list is unbounded */\n");
+    printf("static const size_t bucket_max[LIST_LIMT] = {");
+    for (k = 0; k < lists; k++) {
+	if (k % 8 == 0)
+	    printf("\n   ");
+	if (k < nsmall)
+	    printf(" %lu,", (unsigned long)(MINSIZE + ALIGNMENT * last[k]));
+	else if (k < lists - 1)
+	    printf(" %lu,", (unsigned long)small_max << (k - nsmall + 1));
+	else
+	    printf(" (size_t)-1");
+    }
+    printf("\n};\n\n");
+
+    printf("/* List of every block size up to BUCKET_SMALL_MAX, by size/8 */\n");
+    printf("static const unsigned char bucket_small[BUCKET_SMALL_MAX/8 + 1] = {");
+    for (i = 0, k = 0; i <= (int)(small_max / ALIGNMENT); i++) {
+	size_t size = i * ALIGNMENT;
+	while (k < nsmall - 1 && size > MINSIZE + ALIGNMENT * last[k])
+	    k++;
+	if (i % 16 == 0)
+	    printf("\n   ");
+	printf(" %d%s", k, i < (int)(small_max / ALIGNMENT) ? "," : "");
+    }
+    printf("\n};\n");
+
+    free(count);
+    free(last);
+    exit(0);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mkbuckets [-h] [-l <lists>] [-s <bytes>] <tracefile>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+    fprintf(stderr, "\t-l <lists>  Number of segregated lists (default %d).\n", DEF_LISTS);
+    fprintf(stderr, "\t-s <bytes>  Largest block size with tuned lists (default %d).\n", DEF_SMALL_MAX);
+}
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
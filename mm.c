@@ -15,9 +15,18 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_inline.h"
 
 /* single word (4) or double word (8) alignment */
 //adapt minsize for explicit list
@@ -25,17 +34,25 @@
 #define WSIZE 4             /* word size */
 #define DSIZE 8             /* doubleword size */
 #define CHUNKSIZE (1<<12)   /* Extend heap by this amount (bytes) */
-#define MINSIZE 24
+#define MINSIZE MM_MINSIZE
 
 //------------EXPLICIT-LIST MACROS/vars-------------------------
-#define GET_NEXT(ptr) (*(char **)(ptr))
-#define GET_PREV(ptr) (*(char **)(ptr + 8))
-#define SET_NEXT(ptr, nxt) (GET_NEXT(ptr) = nxt)
-#define SET_PREV(ptr, prev) (GET_PREV(ptr) = prev)
+//links are absolute pointers, or offsets with "make PIC=1"; see mm_link
+#define GET_NEXT(ptr) MMI_NEXT(ptr)
+#define GET_PREV(ptr) MMI_PREV(ptr)
+#define SET_NEXT(ptr, nxt) MMI_SET_NEXT(ptr, nxt)
+#define SET_PREV(ptr, prev) MMI_SET_PREV(ptr, prev)
+
+//pull in the next free block's header while the current one is tested
+#ifdef MM_NO_PREFETCH
+#define PREFETCH(bp) do { } while(0)
+#else
+#define PREFETCH(bp) do { if(bp) __builtin_prefetch((char *)(bp) - WSIZE); } while(0)
+#endif
 
 //------------SEGREGATED-LIST MACROS/vars-------------------------
-#define LIST_LIMT 20
-void *seg_lists[LIST_LIMT];
+//LIST_LIMT and the size class table come from mkbuckets ("make buckets"),
+//by way of mm_inline.h
 
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
@@ -43,54 +60,90 @@ void *seg_lists[LIST_LIMT];
 #define PUT(p, val) (*(unsigned int *)(p) = (val)) //write 4 bytes
 #define GET(p) (*(unsigned int *)(p)) //Read content of word 
 #define GET_ALLOC(p) (*(unsigned int *)(p) & 0x1)
+#define EXCL 0x4 //tag bit: allocated with MM_EXCLUSIVE
+#define GET_EXCL(p) (*(unsigned int *)(p) & EXCL)
+#define PURGED 0x4 //same bit on a free block: its whole pages went back to the OS
+#define SAMPLED MMI_SAMPLED //tag bit: allocated block recorded by the profiler
 #define SIZE(p) ((GET(p)) & ~0x7) //Get word value and 0 out last three bits
 
 #define HDRP(p) ((char *)(p) - WSIZE)
 #define FTRP(p) ((char *)(p) + SIZE(HDRP(p)) - 8) //retreive block size from header (-4 bytes) then add that to the ptr - 4
 #define NEXT_BLKP(p) ((char *)(p) + SIZE((char *)(p) - 4))
 #define LAST_BLKP(p) ((char *)(p) - SIZE((char *)(p) - 8)) //read footer of prev move ptr back by its size
-static char *heap_listp;
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#define HANDLE_OF(bp) (*(long *)(bp)) //first word of a handle block (see mm_halloc_h)
 
-static int get_idx(size_t size){
-    int list = 0;
-    size_t threshold = 32;
-    while(list < LIST_LIMT -1){
-        if(size <= threshold){
-            return list;
-        }
-        list++;
-        threshold <<= 1;
-    }
-    return list;
-}
-static void insert_node_seg(void *bp)
+//------------DECAY PURGING-------------------------------------------
+//every malloc and free counts towards the next look at the clock;
+//the inline fast paths tick the same counter
+#define DECAY_TICK(h) mm_decay_tick(h)
+
+//------------PROFILING-----------------------------------------------
+//counts size bytes down towards the next sample; with the profiler off
+//sample_left starts at LONG_MAX, so this is all an allocation pays
+#define SAMPLE_TICK(h, bp, size) do { if(((h)->sample_left -= (size)) < 0) mm_sample(h, bp, size); } while(0)
+static void profile_reset(mm_heap_t *h);
+static void profile_forget(mm_heap_t *h, char *bp);
+static void profile_move(mm_heap_t *h, char *from, char *to);
+
+//------------STATISTICS (only compiled in with -DMM_STATS)------------
+#ifdef MM_STATS
+#define STAT(stmt) do { stmt; } while(0)
+#define STAT_LIVE(size, sign) do { \
+        int c_ = get_idx(size); \
+        h->stats.live_blocks[c_] += (sign); \
+        h->stats.live_bytes[c_] += (sign) * (long)(size); \
+        if(h->stats.live_bytes[c_] > h->stats.peak_bytes[c_]) h->stats.peak_bytes[c_] = h->stats.live_bytes[c_]; \
+    } while(0)
+#else
+#define STAT(stmt) do { } while(0)
+#define STAT_LIVE(size, sign) do { } while(0)
+#endif
+
+//------------HEAP INSTANCE-------------------------------------------
+//struct mm_heap lives in mm_inline.h so the fast paths can see the lists
+static mm_heap_t default_heap = { .line = MM_LINE, .decay_ms = -1, .sample_left = LONG_MAX };
+
+//------------CONSISTENCY CHECKS (per-call hooks only compiled in with -DMM_CHECK)------
+static int check_mode = MM_CHECK_OFF;
+static void check_call(mm_heap_t *h, const char *op, void *bp);
+#ifdef MM_CHECK
+#define CHECK_CALL(op, bp) do { if(check_mode) check_call(h, op, bp); } while(0)
+#else
+#define CHECK_CALL(op, bp) do { } while(0)
+#endif
+
+#define get_idx(size) mm_size_class(size)
+
+static void insert_node_seg(mm_heap_t *h, void *bp)
 {
     int idx = get_idx(SIZE(HDRP(bp)));
-    if(seg_lists[idx] == NULL){
-        seg_lists[idx] = bp;
+    mm_cache_push(h, idx, bp, SIZE(HDRP(bp)));
+    if(h->seg_lists[idx] == NULL){
+        h->seg_lists[idx] = bp;
         SET_NEXT(bp, NULL);
         SET_PREV(bp, NULL);
     }else {
-        SET_PREV(seg_lists[idx], bp); 
-        SET_NEXT(bp, seg_lists[idx]); 
+        SET_PREV(h->seg_lists[idx], bp); 
+        SET_NEXT(bp, h->seg_lists[idx]); 
         SET_PREV(bp, NULL);       
 
-        seg_lists[idx] = bp;
+        h->seg_lists[idx] = bp;
     }
 }
 
 
 //this function removes a node from the free list (watch out for edge cases)
-static void delete_node_seg(void *bp){
+static void delete_node_seg(mm_heap_t *h, void *bp){
     char *prev, *nxt;
     int idx = get_idx(SIZE(HDRP(bp)));
+    mm_cache_drop(h, idx, bp);
     //delete root (what if only root exists?)
-    if(bp == seg_lists[idx]){
-        seg_lists[idx] = GET_NEXT(bp);
-        if(seg_lists[idx] != NULL){
-            SET_PREV(seg_lists[idx], NULL);
+    if(bp == h->seg_lists[idx]){
+        h->seg_lists[idx] = GET_NEXT(bp);
+        if(h->seg_lists[idx] != NULL){
+            SET_PREV(h->seg_lists[idx], NULL);
         }
     } 
     //delete last Node
@@ -106,35 +159,51 @@ static void delete_node_seg(void *bp){
         SET_PREV(nxt, prev);
     }
 }
+//merging at mp turns the tags around mp and the right block's links into
+//payload; zero what of them lies in never-used memory so calloc can trust it
+static void clean_seam(mm_heap_t *h, char *mp)
+{
+    char *lo = mp - DSIZE, *hi = mp + 2 * sizeof(char *);
+    if(hi <= h->clean_lo) return;
+    if(lo < h->clean_lo) lo = h->clean_lo;
+    memset(lo, 0, hi - lo);
+}
+
 //merges free blocks laying next to each other
-static void *coalesce(void * ptr)
+static void *coalesce(mm_heap_t *h, void * ptr)
 {
     size_t last_a = GET_ALLOC(HDRP(LAST_BLKP(ptr)));
     size_t next_a = GET_ALLOC(HDRP(NEXT_BLKP(ptr)));
 
     if(last_a == 0){
+        STAT(h->stats.coalesces++);
         //remove from free list
-        delete_node_seg(LAST_BLKP(ptr));
+        delete_node_seg(h, LAST_BLKP(ptr));
+        char *seam = ptr;
         size_t cur_size = SIZE(HDRP(ptr));
         size_t prev_size = SIZE(HDRP(LAST_BLKP(ptr)));
         ptr = LAST_BLKP(ptr);
         PUT(HDRP(ptr), PACK(cur_size + prev_size, 0));
         PUT(FTRP(ptr), PACK(cur_size + prev_size, 0));
+        clean_seam(h, seam);
     }
     if(next_a == 0){
+        STAT(h->stats.coalesces++);
         //remove from free list
-        delete_node_seg(NEXT_BLKP(ptr));
+        delete_node_seg(h, NEXT_BLKP(ptr));
+        char *seam = NEXT_BLKP(ptr);
         size_t cur_size = SIZE(HDRP(ptr));
         size_t next_size = SIZE(HDRP(NEXT_BLKP(ptr)));
         PUT(HDRP(ptr), PACK(cur_size + next_size, 0));
         PUT(FTRP(ptr), PACK(cur_size + next_size, 0));
+        clean_seam(h, seam);
     }
-    insert_node_seg(ptr);
+    insert_node_seg(h, ptr);
     return ptr;
 }
 
 //extend heap by words many words called (1) in init phase and (2) when no block is free
-static void *extend_heap(size_t words)
+static void *extend_heap(mm_heap_t *h, size_t words)
 {
     char *bp;
     size_t size;
@@ -142,115 +211,302 @@ static void *extend_heap(size_t words)
     //size in bytes
     //bp points to first byte outside of old heap
     size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-    if(((bp = mem_sbrk(size)) == (void *)-1)) return NULL;
+    if(((bp = memlib_sbrk(h->mem, size)) == (void *)-1)) return NULL;
+    STAT(h->stats.extends++; h->stats.extend_bytes += size);
     //note: bp points to payload area of new free block, thus new header is overwriting old epilogue header
     PUT(HDRP(bp), PACK(size, 0)); //free block hdr
     PUT(FTRP(bp), PACK(size, 0)); //free block ftr
     PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); //new epilogue header 
     
-    return coalesce(bp);
+    return coalesce(h, bp);
 
 }
-/* 
- * mm_init - initialize the malloc package.
- */
-int mm_init(void)
+//a heap struct on mem with the default settings, not yet initialized
+static mm_heap_t *heap_new(memlib_t *mem)
+{
+    mm_heap_t *h;
+    if((h = malloc(sizeof(mm_heap_t))) == NULL) return NULL;
+    h->mem = mem;
+    h->line = MM_LINE;
+    h->place_flags = 0;
+    h->decay_ms = -1;
+    h->shared = NULL;
+    h->handles = NULL;
+    h->hcap = 0;
+    h->sample_left = LONG_MAX;
+    h->prof = NULL;
+    return h;
+}
+
+//forgets everything but the settings, before the heap is (re)built
+static void heap_reset(mm_heap_t *h)
 {
     for(int i = 0; i < LIST_LIMT; i++){
-        seg_lists[i] = NULL;
+        h->seg_lists[i] = NULL;
     }
+#if MM_HEAD_CACHE > 0
+    memset(h->heads, 0, sizeof(h->heads));
+#endif
+    STAT(memset(&h->stats, 0, sizeof(h->stats)));
+    h->clean_lo = memlib_clean_lo(h->mem);
+    h->decay_calls = 0;
+    h->epoch_end = 0;
+    h->freed = 0;
+    memset(h->backlog, 0, sizeof(h->backlog));
+    memset(&h->decay, 0, sizeof(h->decay));
+    h->nhandles = 1;
+    h->hfree = 0;
+    h->hfreed = 0;
+    memset(&h->compact, 0, sizeof(h->compact));
+    profile_reset(h);
+}
+
+/*
+ * mm_create - make an independent heap that takes its memory from mem.
+ *     Returns NULL if it can't be set up.
+ */
+mm_heap_t *mm_create(memlib_t *mem)
+{
+    mm_heap_t *h;
+    if((h = heap_new(mem)) == NULL) return NULL;
+    if(mm_init_h(h) < 0){
+        free(h);
+        return NULL;
+    }
+    return h;
+}
+
+//releases a heap made by mm_create (its memlib_t stays with the caller)
+void mm_destroy(mm_heap_t *h)
+{
+    mm_set_profile_h(h, 0);
+    free(h->handles);
+    free(h);
+}
+
+/* 
+ * mm_init_h - (re)initialize a heap on whatever its memlib holds; reset
+ *     the memlib's brk first to start from an empty heap.
+ */
+int mm_init_h(mm_heap_t *h)
+{
+    heap_reset(h);
     
     //mem_sbrk return a pointer to -1 if something went wrong
-    if((heap_listp = mem_sbrk(4 * WSIZE)) == (void *) -1) return -1;
+    if((h->heap_listp = memlib_sbrk(h->mem, 4 * WSIZE)) == (void *) -1) return -1;
 
-    PUT(heap_listp, 0); //initial 4 bytes padding
-    PUT(heap_listp + (WSIZE), PACK(DSIZE, 1)); //prologue hdr
-    PUT(heap_listp + (2*WSIZE), PACK(DSIZE, 1)); //prologue ftr
-    PUT(heap_listp + (3*WSIZE), PACK(0, 1)); //epilogue hdr
+    PUT(h->heap_listp, 0); //initial 4 bytes padding
+    PUT(h->heap_listp + (WSIZE), PACK(DSIZE, 1)); //prologue hdr
+    PUT(h->heap_listp + (2*WSIZE), PACK(DSIZE, 1)); //prologue ftr
+    PUT(h->heap_listp + (3*WSIZE), PACK(0, 1)); //epilogue hdr
 
-    heap_listp += (2*WSIZE);
-    if(extend_heap(CHUNKSIZE/WSIZE) == NULL) return -1;
+    h->heap_listp += (2*WSIZE);
+    if(extend_heap(h, CHUNKSIZE/WSIZE) == NULL) return -1;
     return 0;
 }
 //splits and allocates blocks
-static void place(void *bp, size_t asize){
+static void place(mm_heap_t *h, void *bp, size_t asize){
     size_t bsize = SIZE(HDRP(bp));
     // unused part of block is large enough to be one on its own -> split it 
     if(bsize - asize >= MINSIZE){
         size_t remainder = bsize - asize;
-        delete_node_seg(bp);
+        unsigned int purged = GET(HDRP(bp)) & PURGED; //the remainder's pages still are
+        STAT(h->stats.splits++);
+        STAT_LIVE(asize, 1);
+        delete_node_seg(h, bp);
         PUT(HDRP(bp), PACK(asize, 1));
         PUT(FTRP(bp), PACK(asize, 1));
-        PUT(HDRP(NEXT_BLKP(bp)), PACK(remainder, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(remainder, 0));
-        insert_node_seg(NEXT_BLKP(bp));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(remainder, purged));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(remainder, purged));
+        insert_node_seg(h, NEXT_BLKP(bp));
     } else {
-        delete_node_seg(bp);
+        STAT_LIVE(bsize, 1);
+        delete_node_seg(h, bp);
         PUT(HDRP(bp), PACK(bsize, 1));
         PUT(FTRP(bp), PACK(bsize, 1));
     }
 }
-//traverses List and returns pointer to first free fitting block
-static void *find_fit(size_t size)
+//traverses List and returns pointer to first free fitting block; the first
+//few sizes of each list come from its head cache, and past those each step
+//prefetches the next block while the current one is tested
+static void *find_fit(mm_heap_t *h, size_t size)
 {
     int idx = get_idx(size);
+    STAT(h->stats.fit_searches++);
 
     //start at the correct index, but keep going up if empty
     for(int i = idx;i < LIST_LIMT; i++) {
-        void *bp = seg_lists[i];
+        char *bp = h->seg_lists[i], *nxt;
+        if(bp == NULL) continue;
+#if MM_HEAD_CACHE > 0
+        mm_head_cache_t *c = &h->heads[i];
+        for(int j = 0; j < c->n; j++){
+            STAT(h->stats.fit_probes++; h->stats.fit_cached++);
+            if(c->size[j] >= size){
+                return c->bp[j];
+            }
+        }
+        if(c->n > 0) bp = GET_NEXT(c->bp[c->n - 1]);
+#endif
 
         while(bp != NULL){
+            nxt = GET_NEXT(bp);
+            PREFETCH(nxt);
+            STAT(h->stats.fit_probes++);
             if(SIZE(HDRP(bp)) >= size){
                 return bp;
             }
-            bp = GET_NEXT(bp);
+#if MM_HEAD_CACHE > 0
+            //walking on from the cached blocks, so bp can extend the cache
+            if(c->n < MM_HEAD_CACHE){
+                c->size[c->n] = SIZE(HDRP(bp));
+                c->bp[c->n++] = bp;
+            }
+#endif
+            bp = nxt;
         }
     }
     return NULL;
 }
 /* 
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * mm_malloc_slow - Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
+ *     mm_malloc_inline has already tried the list heads.
  */
-void *mm_malloc(size_t size)
+void *mm_malloc_slow(mm_heap_t *h, size_t size)
 {
     size_t asize, esize;
     char * bp;
+    if(h->place_flags & MM_EXCLUSIVE) return mm_malloc_flags_h(h, size, 0);
+    DECAY_TICK(h);
+    STAT(h->stats.mallocs++);
     if(size == 0) return NULL;
     //Adjust block size to include overhead (+ DSIZE) and alignment reqs (mult of DSIZE).
-    if(size <= 2 * DSIZE){
-        asize = MINSIZE;
-    } else {
-        asize = ALIGN(size) + DSIZE;
-    }
+    asize = mm_adjust_size(size);
     
     //find fit 
-    if((bp = find_fit(asize)) != NULL){
-        place(bp, asize);
+    if((bp = find_fit(h, asize)) != NULL){
+        place(h, bp, asize);
     } else {
         //extend heap
         esize = (CHUNKSIZE > asize) ? CHUNKSIZE : asize;
-        if((bp = extend_heap(esize/WSIZE)) == NULL) return NULL;
-        place(bp, asize);
+        if((bp = extend_heap(h, esize/WSIZE)) == NULL) return NULL;
+        place(h, bp, asize);
     }
+    mm_mark_used(h, bp, SIZE(HDRP(bp)));
+    SAMPLE_TICK(h, bp, size);
+    CHECK_CALL("mm_malloc", bp);
     return bp;
 }
 
 /*
- * mm_free - Freeing a block does nothing.
+ * malloc_exclusive - Allocate a block whose payload starts on a cache line
+ *     and covers whole lines, so no other payload shares a line with it.
+ *     The slack in front of the line becomes a free block of its own.
  */
-void mm_free(void *ptr)
+static void *malloc_exclusive(mm_heap_t *h, size_t size)
+{
+    size_t line = h->line;
+    size_t asize = ((size + line - 1) & ~(line - 1)) + DSIZE; //whole lines of payload
+    size_t search = asize + line + MINSIZE; //room to slide up to a line boundary
+    size_t bsize, gap, rest, esize;
+    char *bp, *abp;
+
+    if((bp = find_fit(h, search)) == NULL){
+        esize = (CHUNKSIZE > search) ? CHUNKSIZE : search;
+        if((bp = extend_heap(h, esize/WSIZE)) == NULL) return NULL;
+    }
+    delete_node_seg(h, bp);
+    bsize = SIZE(HDRP(bp));
+
+    //the gap below the line must be big enough to be a free block
+    abp = (char *)(((uintptr_t)bp + line - 1) & ~(uintptr_t)(line - 1));
+    if(abp != bp && abp - bp < MINSIZE) abp += line;
+    gap = abp - bp;
+    rest = bsize - gap;
+    if(gap > 0){
+        STAT(h->stats.splits++);
+        PUT(HDRP(bp), PACK(gap, 0));
+        PUT(FTRP(bp), PACK(gap, 0));
+        insert_node_seg(h, bp);
+    }
+    if(rest - asize >= MINSIZE){
+        STAT(h->stats.splits++);
+        PUT(HDRP(abp), PACK(asize, 1 | EXCL));
+        PUT(FTRP(abp), PACK(asize, 1 | EXCL));
+        PUT(HDRP(NEXT_BLKP(abp)), PACK(rest - asize, 0));
+        PUT(FTRP(NEXT_BLKP(abp)), PACK(rest - asize, 0));
+        insert_node_seg(h, NEXT_BLKP(abp));
+    } else {
+        asize = rest;
+        PUT(HDRP(abp), PACK(asize, 1 | EXCL));
+        PUT(FTRP(abp), PACK(asize, 1 | EXCL));
+    }
+    STAT_LIVE(asize, 1);
+    STAT(h->stats.exclusives++; h->stats.exclusive_pad += gap + asize - DSIZE - size);
+    mm_mark_used(h, abp, asize);
+    SAMPLE_TICK(h, abp, size);
+    CHECK_CALL("mm_malloc", abp);
+    return abp;
+}
+
+/*
+ * mm_malloc_flags_h - mm_malloc_h, with MM_EXCLUSIVE giving the block
+ *     cache lines of its own
+ */
+void *mm_malloc_flags_h(mm_heap_t *h, size_t size, int flags)
+{
+    if(!((flags | h->place_flags) & MM_EXCLUSIVE)) return mm_malloc_inline(h, size);
+    DECAY_TICK(h);
+    STAT(h->stats.mallocs++);
+    if(size == 0) return NULL;
+    return malloc_exclusive(h, size);
+}
+
+/*
+ * mm_set_placement_h - set the cache line size exclusive blocks are
+ *     placed by (64 or 128, for CPUs that fetch lines in pairs), and flags
+ *     to apply to every allocation. Returns -1 for any other line size.
+ */
+int mm_set_placement_h(mm_heap_t *h, size_t line, int flags)
+{
+    if(line != 64 && line != 128) return -1;
+    h->line = line;
+    h->place_flags = flags;
+    return 0;
+}
+
+/*
+ * mm_free_slow - Free a block and merge it with free neighbours.
+ */
+void mm_free_slow(mm_heap_t *h, void *ptr)
 {
     size_t size = SIZE(HDRP(ptr));
+    DECAY_TICK(h);
+    STAT(h->stats.frees++);
+    STAT_LIVE(size, -1);
+    h->freed += size;
+    if(GET(HDRP(ptr)) & SAMPLED) profile_forget(h, ptr);
     PUT(HDRP(ptr), PACK(size, 0));
     PUT(FTRP(ptr), PACK(size, 0));
-    coalesce(ptr);
+    ptr = coalesce(h, ptr);
+    CHECK_CALL("mm_free", ptr);
+}
+
+void *mm_malloc_h(mm_heap_t *h, size_t size)
+{
+    return mm_malloc_inline(h, size);
+}
+
+void mm_free_h(mm_heap_t *h, void *ptr)
+{
+    mm_free_inline(h, ptr);
 }
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * mm_realloc_h - Implemented simply in terms of mm_malloc and mm_free
  */
-void *mm_realloc(void *ptr, size_t size)
+void *mm_realloc_h(mm_heap_t *h, void *ptr, size_t size)
 {
     bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(ptr))); //is next block allocated?
     size_t next_size = SIZE(HDRP(NEXT_BLKP(ptr))); //size of next block
@@ -260,37 +516,1264 @@ void *mm_realloc(void *ptr, size_t size)
     char *new_ptr;
 
 
+    STAT(h->stats.reallocs++);
     if(size == 0) return NULL;
-    if(ptr == NULL) return mm_malloc(size);
+    if(ptr == NULL) return mm_malloc_h(h, size);
 
-    if(new_size <= old_size) return ptr;
+    if(new_size <= old_size) {
+        STAT(h->stats.realloc_inplace++);
+        CHECK_CALL("mm_realloc", ptr);
+        return ptr;
+    }
 
-    if(!next_alloc && (combined_size >= new_size)) {
-        delete_node_seg(NEXT_BLKP(ptr));
-        PUT(HDRP(ptr), PACK(combined_size, 1));
-        PUT(FTRP(ptr), PACK(combined_size, 1));
+    //growing an exclusive block in place would let its last line be shared
+    if(!next_alloc && (combined_size >= new_size) && !GET_EXCL(HDRP(ptr))) {
+        STAT(h->stats.realloc_grow++);
+        STAT_LIVE(old_size, -1);
+        STAT_LIVE(combined_size, 1);
+        unsigned int sampled = GET(HDRP(ptr)) & SAMPLED; //stays in the profile
+        delete_node_seg(h, NEXT_BLKP(ptr));
+        PUT(HDRP(ptr), PACK(combined_size, 1 | sampled));
+        PUT(FTRP(ptr), PACK(combined_size, 1 | sampled));
+        mm_mark_used(h, ptr, combined_size);
+        CHECK_CALL("mm_realloc", ptr);
         return ptr;
     } else {
-        new_ptr = mm_malloc(size);
+        STAT(h->stats.realloc_copy++);
+        new_ptr = mm_malloc_flags_h(h, size, GET_EXCL(HDRP(ptr)) ? MM_EXCLUSIVE : 0);
         if(new_ptr == NULL) { //check if alloc failed
             return NULL;
         }
         memcpy(new_ptr, ptr, old_size - DSIZE); //copy old data to new block
-        mm_free(ptr);
+        mm_free_h(h, ptr);
+        CHECK_CALL("mm_realloc", new_ptr);
         return new_ptr;
     }
 }
 
+/*
+ * mm_calloc_h - Allocate a zeroed array. A block carved from memory no
+ *     payload has used yet is zero already, apart from the free-list
+ *     links it carried, so only reused blocks need a full clear.
+ */
+void *mm_calloc_h(mm_heap_t *h, size_t nmemb, size_t size)
+{
+    size_t bytes;
+    char *clean = h->clean_lo, *bp;
+
+    if(nmemb != 0 && size > (size_t)-1 / nmemb) return NULL; //overflow
+    bytes = nmemb * size;
+    STAT(h->stats.callocs++);
+    if((bp = mm_malloc_h(h, bytes)) == NULL) return NULL;
+    if(HDRP(bp) >= clean){
+        STAT(h->stats.calloc_fresh++);
+        memset(bp, 0, bytes < 2 * sizeof(char *) ? bytes : 2 * sizeof(char *));
+    } else {
+        memset(bp, 0, bytes);
+    }
+    return bp;
+}
+
+//---------------------HANDLES--------------------------------------
+//A handle indexes a slot that holds its block's address. The block keeps
+//the handle in its first 8 bytes, in front of what the caller sees, so a
+//pass in address order can tell which slot to update when it moves the
+//block: a block whose first word names a slot that names the block back
+//is a handle block, whatever a raw mm_malloc block happens to hold there.
+struct mm_hslot {
+    char *bp;       //the block, or NULL for a slot on the free chain
+    int locks;      //mm_hlock calls not yet undone; a locked block stays put
+    int next;       //next slot on the free chain
+};
+
+//compact before growing the heap once freed handle blocks add up to this
+//share of it
+#define COMPACT_SHARE 16
+
+
+//the slot of a live handle, or NULL
+static struct mm_hslot *hslot(mm_heap_t *h, mm_handle_t hd)
+{
+    if(hd <= 0 || hd >= h->nhandles || h->handles[hd].bp == NULL) return NULL;
+    return &h->handles[hd];
+}
+
+//is bp a handle block that nothing has locked?
+static int movable(mm_heap_t *h, char *bp)
+{
+    long hd = HANDLE_OF(bp);
+    if(GET_EXCL(HDRP(bp)) || hd <= 0 || hd >= h->nhandles) return 0;
+    return h->handles[hd].bp == bp && h->handles[hd].locks == 0;
+}
+
+/*
+ * mm_halloc_h - allocate a movable block of size bytes; reach it with
+ *     mm_hlock_h. If the heap would have to grow, and enough handle
+ *     blocks have been freed since the last compaction, compacts first.
+ *     Returns 0 if out of memory.
+ */
+mm_handle_t mm_halloc_h(mm_heap_t *h, size_t size)
+{
+    size_t asize;
+    struct mm_hslot *s;
+    mm_handle_t hd;
+    char *bp;
+
+    if(size == 0 || size > (size_t)-1 - 2 * DSIZE) return 0;
+    asize = mm_adjust_size(size + DSIZE);
+    if(h->hfreed >= asize && h->hfreed >= memlib_heapsize(h->mem) / COMPACT_SHARE &&
+       find_fit(h, asize) == NULL){
+        mm_compact_h(h);
+    }
+
+    if(h->hfree == 0 && h->nhandles >= h->hcap){
+        int cap = h->hcap ? 2 * h->hcap : 64;
+        if((s = realloc(h->handles, cap * sizeof(*s))) == NULL) return 0;
+        h->handles = s;
+        h->hcap = cap;
+    }
+    if((bp = mm_malloc_h(h, size + DSIZE)) == NULL) return 0;
+    if(h->hfree != 0){
+        hd = h->hfree;
+        h->hfree = h->handles[hd].next;
+    } else {
+        hd = h->nhandles++;
+    }
+    h->handles[hd].bp = bp;
+    h->handles[hd].locks = 0;
+    HANDLE_OF(bp) = hd;
+    return hd;
+}
+
+/*
+ * mm_hlock_h - the handle's memory, which stays where it is until the
+ *     matching mm_hunlock_h. Locks nest. Returns NULL for a bad handle.
+ */
+void *mm_hlock_h(mm_heap_t *h, mm_handle_t hd)
+{
+    struct mm_hslot *s = hslot(h, hd);
+    if(s == NULL) return NULL;
+    s->locks++;
+    return s->bp + DSIZE;
+}
+
+void mm_hunlock_h(mm_heap_t *h, mm_handle_t hd)
+{
+    struct mm_hslot *s = hslot(h, hd);
+    if(s != NULL && s->locks > 0) s->locks--;
+}
+
+/*
+ * mm_hrealloc_h - resize the handle's block, keeping the handle. Returns
+ *     -1, leaving the block as it was, if the handle is locked or bad or
+ *     memory runs out.
+ */
+int mm_hrealloc_h(mm_heap_t *h, mm_handle_t hd, size_t size)
+{
+    struct mm_hslot *s = hslot(h, hd);
+    size_t old;
+    char *bp;
+
+    if(s == NULL || s->locks > 0 || size == 0 || size > (size_t)-1 - 2 * DSIZE) return -1;
+    old = SIZE(HDRP(s->bp));
+    if((bp = mm_realloc_h(h, s->bp, size + DSIZE)) == NULL) return -1;
+    if(bp != s->bp) h->hfreed += old;
+    s->bp = bp;
+    return 0;
+}
+
+//frees the handle's block, and the handle
+void mm_hfree_h(mm_heap_t *h, mm_handle_t hd)
+{
+    struct mm_hslot *s = hslot(h, hd);
+    if(s == NULL) return;
+    h->hfreed += SIZE(HDRP(s->bp));
+    mm_free_h(h, s->bp);
+    s->bp = NULL;
+    s->next = h->hfree;
+    h->hfree = hd;
+}
+
+//the free space [lo, bp) ends at a block that stays put: make it a free
+//block, or if it is too small for one, give it to last, the block below it
+static void close_gap(mm_heap_t *h, char *lo, char *bp, char *last)
+{
+    size_t gap = bp - lo;
+    if(gap >= MINSIZE){
+        PUT(HDRP(lo), PACK(gap, 0));
+        PUT(FTRP(lo), PACK(gap, 0));
+        insert_node_seg(h, lo);
+        return;
+    }
+    //a gap under MINSIZE only opens up behind a block that was moved
+    assert(last != NULL && last + SIZE(HDRP(last)) == lo);
+    gap += SIZE(HDRP(last));
+    PUT(HDRP(last), PACK(gap, 1 | (GET(HDRP(last)) & SAMPLED)));
+    PUT(FTRP(last), GET(HDRP(last)));
+}
+
+/*
+ * mm_compact_h - slide every unlocked handle block down over the free
+ *     space below it, in one pass in address order. Raw mm_malloc blocks
+ *     and locked handles stay where they are; the space that is left in
+ *     front of them becomes free blocks again. The free space left at the
+ *     top goes back to memlib. Returns the bytes the heap shrank by.
+ */
+size_t mm_compact_h(mm_heap_t *h)
+{
+    char *bp, *next, *lo = NULL, *last = NULL;
+    size_t size, released = 0;
+
+    //every free block is either merged into a gap or put back by close_gap
+    for(int i = 0; i < LIST_LIMT; i++){
+        h->seg_lists[i] = NULL;
+    }
+#if MM_HEAD_CACHE > 0
+    memset(h->heads, 0, sizeof(h->heads));
+#endif
+    for(bp = NEXT_BLKP(h->heap_listp); (size = SIZE(HDRP(bp))) > 0; bp = next){
+        next = bp + size;
+        if(!GET_ALLOC(HDRP(bp))){
+            if(lo == NULL) lo = bp;
+        } else if(movable(h, bp)){
+            if(lo != NULL){
+                memmove(HDRP(lo), HDRP(bp), size);
+                h->handles[HANDLE_OF(lo)].bp = lo;
+                if(GET(HDRP(lo)) & SAMPLED) profile_move(h, bp, lo);
+                h->compact.moved += size;
+                bp = lo;
+                lo += size;
+            }
+            last = bp;
+        } else {
+            if(lo != NULL) close_gap(h, lo, bp, last);
+            lo = last = NULL;
+        }
+    }
+    //bp is the epilogue; move it down to lo and give the rest back
+    if(lo != NULL){
+        released = bp - lo;
+        PUT(HDRP(lo), PACK(0, 1));
+        memlib_sbrk(h->mem, -(int)released);
+    }
+    h->hfreed = 0;
+    h->compact.compactions++;
+    h->compact.released += released;
+    CHECK_CALL("mm_compact", NULL);
+    return released;
+}
+
+//what compaction has done since mm_init
+void mm_compact_stats_h(mm_heap_t *h, mm_compact_stats_t *stats)
+{
+    *stats = h->compact;
+}
+
+//---------------------DECAY PURGING--------------------------------
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+//bytes in the whole pages of free block bp past its links and before its
+//footer, i.e. what purging it hands back
+static size_t purgeable(char *bp, size_t size, size_t page)
+{
+    size_t lo = ((size_t)bp + 2 * sizeof(char *) + page - 1) & ~(page - 1);
+    size_t hi = ((size_t)bp + size - DSIZE) & ~(page - 1);
+    return (hi > lo) ? hi - lo : 0;
+}
+
+//share of the bytes freed age epochs ago that may still be resident: a
+//smoothstep curve, flat at both ends, from all of them down to none
+static double decay_keep(int age)
+{
+    double x = (double)age / MM_DECAY_EPOCHS;
+    return 1.0 - x * x * (3 - 2 * x);
+}
+
+//measures the resident free pages, then purges blocks, largest first, until
+//no more than limit bytes of them are left
+static void purge(mm_heap_t *h, size_t limit)
+{
+    size_t page = mem_pagesize(), dirty = 0, size, n, got;
+    int first = get_idx(page + MINSIZE); //smaller blocks never hold a whole page
+    char *bp;
+
+    for(int i = first; i < LIST_LIMT; i++){
+        for(bp = h->seg_lists[i]; bp != NULL; bp = GET_NEXT(bp)){
+            if(!(GET(HDRP(bp)) & PURGED)) dirty += purgeable(bp, SIZE(HDRP(bp)), page);
+        }
+    }
+    for(int i = LIST_LIMT - 1; i >= first && dirty > limit; i--){
+        for(bp = h->seg_lists[i]; bp != NULL && dirty > limit; bp = GET_NEXT(bp)){
+            size = SIZE(HDRP(bp));
+            if((GET(HDRP(bp)) & PURGED) || (n = purgeable(bp, size, page)) == 0) continue;
+            //a split remainder keeps the bit, but merging clears it, so a
+            //block may come back here with most of its pages gone already
+            got = memlib_purge(h->mem, bp + 2 * sizeof(char *), bp + size - DSIZE);
+            PUT(HDRP(bp), PACK(size, PURGED));
+            PUT(FTRP(bp), PACK(size, PURGED));
+            dirty -= n;
+            if(got > 0){
+                h->decay.released += got;
+                h->decay.purges++;
+            }
+        }
+    }
+    h->decay.dirty = dirty;
+}
+
+/*
+ * mm_decay_h - close the decay epochs that have passed and purge the free
+ *     pages the curve no longer lets the heap hold: everything freed in
+ *     the current epoch stays, and of what was freed earlier, less and
+ *     less the older it is, until a full window after the free none of it
+ *     does. A burst that is reused within the window keeps its pages.
+ *     mm_malloc and mm_free call this every MM_DECAY_CALLS calls; a
+ *     program that goes idle can call it itself, e.g. from a timer (under
+ *     its own lock, as the heap is not thread-safe).
+ */
+void mm_decay_h(mm_heap_t *h)
+{
+    long long now, epoch;
+    double limit;
+
+    h->decay_calls = 0;
+    if(h->decay_ms < 0) return;
+    if(h->decay_ms == 0){
+        h->freed = 0;
+        purge(h, 0);
+        return;
+    }
+    now = now_ns();
+    epoch = h->decay_ms * 1000000LL / MM_DECAY_EPOCHS;
+    if(h->epoch_end == 0) h->epoch_end = now + epoch;
+    if(now < h->epoch_end) return;
+
+    //after a long idle spell, one pass per epoch up to a whole window
+    for(int k = 0; now >= h->epoch_end && k <= MM_DECAY_EPOCHS; k++){
+        memmove(&h->backlog[1], &h->backlog[0], (MM_DECAY_EPOCHS - 1) * sizeof(h->backlog[0]));
+        h->backlog[0] = h->freed;
+        h->freed = 0;
+        h->epoch_end += epoch;
+    }
+    if(now >= h->epoch_end) h->epoch_end = now + epoch;
+
+    limit = 0;
+    for(int i = 0; i < MM_DECAY_EPOCHS; i++){
+        limit += h->backlog[i] * decay_keep(i + 1);
+    }
+    purge(h, (size_t)limit);
+}
+
+/*
+ * mm_set_decay_h - purge free pages that stay unused for about ms
+ *     milliseconds (0 purges at every check, a negative ms never).
+ *     Returns -1 for a window longer than a day.
+ */
+int mm_set_decay_h(mm_heap_t *h, long ms)
+{
+    if(ms > 24L * 3600 * 1000) return -1;
+    h->decay_ms = (ms < 0) ? -1 : ms;
+    h->epoch_end = 0;
+    return 0;
+}
+
+//what purging has done since mm_init
+void mm_decay_stats_h(mm_heap_t *h, mm_decay_stats_t *stats)
+{
+    *stats = h->decay;
+}
+
+//---------------------SAMPLED PROFILING----------------------------
+//The gaps between samples are exponentially distributed with mean rate
+//bytes, so every byte allocated is equally likely to trigger one and the
+//sample says nothing about the allocation pattern; pprof scales each
+//sample back up by 1/(1 - exp(-size/rate)). Sampled blocks carry the
+//SAMPLED bit, so only their frees look the sample up. Everything here
+//lives in libc memory, outside the heap.
+#define PROF_DEPTH 32       //frames kept per call stack
+#define PROF_BUCKETS 1024   //hash chains for sites and for samples
+
+struct prof_site {
+    void *pc[PROF_DEPTH];
+    int depth;
+    unsigned long live, live_bytes;     //samples not freed yet ...
+    unsigned long total, total_bytes;   //... and all taken here since mm_init
+    struct prof_site *next;
+};
+
+struct prof_sample {
+    char *bp;
+    size_t size;                //what was asked for
+    struct prof_site *site;
+    struct prof_sample *next;
+};
+
+struct mm_profile {
+    size_t rate;                //mean bytes between samples
+    uint64_t rng;               //xorshift64 state
+    struct prof_site *sites[PROF_BUCKETS];
+    struct prof_sample *samples[PROF_BUCKETS];
+    mm_profile_stats_t stats;
+};
+
+//bytes to allocate before the next sample
+static long next_interval(struct mm_profile *p)
+{
+    double u, gap;
+    p->rng ^= p->rng << 13;
+    p->rng ^= p->rng >> 7;
+    p->rng ^= p->rng << 17;
+    u = ((p->rng >> 11) + 1) * (1.0 / 9007199254740992.0); //(0, 1]
+    gap = -log(u) * p->rate;
+    return gap < LONG_MAX / 2 ? (long)gap : LONG_MAX / 2;
+}
+
+static struct prof_sample **sample_slot(struct mm_profile *p, char *bp)
+{
+    struct prof_sample **sp = &p->samples[((uintptr_t)bp >> 3) % PROF_BUCKETS];
+    while(*sp != NULL && (*sp)->bp != bp) sp = &(*sp)->next;
+    return sp;
+}
+
+//the site for this call stack, made if it is new
+static struct prof_site *find_site(struct mm_profile *p, void **pc, int depth)
+{
+    uintptr_t hash = 0;
+    struct prof_site *s;
+
+    for(int i = 0; i < depth; i++){
+        hash = (hash ^ (uintptr_t)pc[i]) * 0x100000001b3ULL;
+    }
+    for(s = p->sites[hash % PROF_BUCKETS]; s != NULL; s = s->next){
+        if(s->depth == depth && memcmp(s->pc, pc, depth * sizeof(void *)) == 0) return s;
+    }
+    if((s = calloc(1, sizeof(*s))) == NULL) return NULL;
+    memcpy(s->pc, pc, depth * sizeof(void *));
+    s->depth = depth;
+    s->next = p->sites[hash % PROF_BUCKETS];
+    p->sites[hash % PROF_BUCKETS] = s;
+    p->stats.sites++;
+    return s;
+}
+
+/*
+ * mm_sample - the allocation of bp, size bytes, used up the byte count
+ *     to the next sample: record it with the stack of its caller, and
+ *     start counting towards the next one
+ */
+void mm_sample(mm_heap_t *h, void *bp, size_t size)
+{
+    struct mm_profile *p = h->prof;
+    void *pc[PROF_DEPTH + 1];
+    struct prof_sample *smp, **sp;
+    struct prof_site *s;
+    int depth;
 
+    if(p == NULL){
+        h->sample_left = LONG_MAX;
+        return;
+    }
+    h->sample_left = next_interval(p);
+    depth = backtrace(pc, PROF_DEPTH + 1) - 1; //without this frame
+    if((s = find_site(p, pc + 1, depth)) == NULL || (smp = malloc(sizeof(*smp))) == NULL) return;
+    sp = &p->samples[((uintptr_t)bp >> 3) % PROF_BUCKETS];
+    smp->bp = bp;
+    smp->size = size;
+    smp->site = s;
+    smp->next = *sp;
+    *sp = smp;
+    s->live++;
+    s->live_bytes += size;
+    s->total++;
+    s->total_bytes += size;
+    p->stats.samples++;
+    p->stats.live++;
+    PUT(HDRP(bp), GET(HDRP(bp)) | SAMPLED);
+    PUT(FTRP(bp), GET(HDRP(bp)));
+}
 
+//sampled block bp is being freed
+static void profile_forget(mm_heap_t *h, char *bp)
+{
+    struct prof_sample **sp, *smp;
 
+    if(h->prof == NULL || *(sp = sample_slot(h->prof, bp)) == NULL) return;
+    smp = *sp;
+    *sp = smp->next;
+    smp->site->live--;
+    smp->site->live_bytes -= smp->size;
+    h->prof->stats.live--;
+    free(smp);
+}
 
+//compaction moved sampled block from to to
+static void profile_move(mm_heap_t *h, char *from, char *to)
+{
+    struct prof_sample **sp, *smp;
 
+    if(h->prof == NULL || *(sp = sample_slot(h->prof, from)) == NULL) return;
+    smp = *sp;
+    *sp = smp->next;
+    smp->bp = to;
+    sp = &h->prof->samples[((uintptr_t)to >> 3) % PROF_BUCKETS];
+    smp->next = *sp;
+    *sp = smp;
+}
 
+//drops every sample and site, keeping the rate
+static void profile_reset(mm_heap_t *h)
+{
+    struct mm_profile *p = h->prof;
 
+    h->sample_left = LONG_MAX;
+    if(p == NULL) return;
+    //mm_init comes here for every heap, so skip walking the buckets when
+    //there is nothing in them: mm_sample only keeps a sample once it has
+    //its site, and sites go only here, so no sites means no samples either
+    if(p->stats.sites > 0){
+        for(int i = 0; i < PROF_BUCKETS; i++){
+            while(p->sites[i] != NULL){
+                struct prof_site *s = p->sites[i];
+                p->sites[i] = s->next;
+                free(s);
+            }
+            while(p->samples[i] != NULL){
+                struct prof_sample *smp = p->samples[i];
+                p->samples[i] = smp->next;
+                free(smp);
+            }
+        }
+    }
+    memset(&p->stats, 0, sizeof(p->stats));
+    h->sample_left = next_interval(p);
+}
 
+/*
+ * mm_set_profile_h - sample about one allocation in every rate bytes
+ *     from now on, or stop profiling (and drop the profile) if rate is 0.
+ *     Returns -1 if the profile can't be allocated.
+ */
+int mm_set_profile_h(mm_heap_t *h, size_t rate)
+{
+    if(rate == 0){
+        profile_reset(h);
+        free(h->prof);
+        h->prof = NULL;
+        h->sample_left = LONG_MAX;
+        return 0;
+    }
+    if(h->prof == NULL){
+        if((h->prof = calloc(1, sizeof(*h->prof))) == NULL) return -1;
+        h->prof->rng = (uint64_t)now_ns() ^ (uintptr_t)h;
+        if(h->prof->rng == 0) h->prof->rng = 1;
+    }
+    h->prof->rate = rate;
+    h->sample_left = next_interval(h->prof);
+    return 0;
+}
+
+/*
+ * mm_profile_dump_h - write the profile to path in pprof's legacy heap
+ *     format: the live and total samples of each call site, then the
+ *     process's mappings to symbolize the addresses with. Returns -1 if
+ *     the heap isn't being profiled or the file can't be written.
+ */
+int mm_profile_dump_h(mm_heap_t *h, const char *path)
+{
+    struct mm_profile *p = h->prof;
+    unsigned long live = 0, live_bytes = 0, total = 0, total_bytes = 0;
+    struct prof_site *s;
+    FILE *fp, *maps;
+    char buf[4096];
+    size_t n;
+
+    if(p == NULL || (fp = fopen(path, "w")) == NULL) return -1;
+    for(int i = 0; i < PROF_BUCKETS; i++){
+        for(s = p->sites[i]; s != NULL; s = s->next){
+            live += s->live;
+            live_bytes += s->live_bytes;
+            total += s->total;
+            total_bytes += s->total_bytes;
+        }
+    }
+    fprintf(fp, "heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%zu\n",
+            live, live_bytes, total, total_bytes, p->rate);
+    for(int i = 0; i < PROF_BUCKETS; i++){
+        for(s = p->sites[i]; s != NULL; s = s->next){
+            fprintf(fp, "%lu: %lu [%lu: %lu] @", s->live, s->live_bytes, s->total, s->total_bytes);
+            for(int j = 0; j < s->depth; j++){
+                fprintf(fp, " %p", s->pc[j]);
+            }
+            fprintf(fp, "\n");
+        }
+    }
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    if((maps = fopen("/proc/self/maps", "r")) != NULL){
+        while((n = fread(buf, 1, sizeof(buf), maps)) > 0){
+            fwrite(buf, 1, n, fp);
+        }
+        fclose(maps);
+    }
+    return fclose(fp) == 0 ? 0 : -1;
+}
 
+//what the profiler has sampled since mm_init
+void mm_profile_stats_h(mm_heap_t *h, mm_profile_stats_t *stats)
+{
+    if(h->prof == NULL){
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = h->prof->stats;
+}
 
+//---------------------SHARED HEAPS---------------------------------
+//What a shared heap's processes must agree on lives in the memlib's shared
+//area, as offsets from the heap's start (0 for NULL). Each process keeps
+//its own mm_heap_t, loads it from there on mm_lock_h and stores it back
+//on mm_unlock_h; in between, the allocator runs as usual.
+struct mm_shared {
+    pthread_mutex_t lock;           //process-shared
+    uintptr_t base;                 //where the creator mapped the heap
+    uint64_t listp;
+    uint64_t clean_lo;
+    uint64_t seg_lists[LIST_LIMT];
+};
 
+static void shared_load(mm_heap_t *h)
+{
+    struct mm_shared *sh = h->shared;
+    char *lo = memlib_heap_lo(h->mem);
 
+    h->heap_listp = lo + sh->listp;
+    h->clean_lo = lo + sh->clean_lo;
+    for(int i = 0; i < LIST_LIMT; i++){
+        h->seg_lists[i] = sh->seg_lists[i] ? lo + sh->seg_lists[i] : NULL;
+    }
+#if MM_HEAD_CACHE > 0
+    memset(h->heads, 0, sizeof(h->heads)); //other processes may have changed the lists
+#endif
+}
 
+static void shared_store(mm_heap_t *h)
+{
+    struct mm_shared *sh = h->shared;
+    char *lo = memlib_heap_lo(h->mem);
+
+    sh->listp = h->heap_listp - lo;
+    sh->clean_lo = h->clean_lo - lo;
+    for(int i = 0; i < LIST_LIMT; i++){
+        sh->seg_lists[i] = h->seg_lists[i] ? (char *)h->seg_lists[i] - lo : 0;
+    }
+}
+
+/*
+ * mm_create_shared - build a new heap in mem, a memlib_create_shared
+ *     memlib, that other processes can use too: children through the
+ *     heap they inherit, others through mm_attach_shared. Returns NULL if
+ *     mem isn't shared or the heap can't be set up.
+ */
+mm_heap_t *mm_create_shared(memlib_t *mem)
+{
+    struct mm_shared *sh = memlib_shared_area(mem);
+    pthread_mutexattr_t attr;
+    mm_heap_t *h;
+
+    if(sh == NULL || sizeof(*sh) > MEMLIB_SHARED_AREA) return NULL;
+    if((h = heap_new(mem)) == NULL) return NULL;
+    if(mm_init_h(h) < 0){
+        free(h);
+        return NULL;
+    }
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&sh->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    sh->base = (uintptr_t)memlib_heap_lo(mem);
+    h->shared = sh;
+    shared_store(h);
+    memlib_sync_out(mem);
+    return h;
+}
+
+/*
+ * mm_attach_shared - use the shared heap another process built in mem.
+ *     Its free-list links are plain pointers unless mm.c was built with
+ *     "make PIC=1", so without that mem must be mapped where the
+ *     creator's was. Returns NULL if it isn't, or mem isn't shared.
+ */
+mm_heap_t *mm_attach_shared(memlib_t *mem)
+{
+    struct mm_shared *sh = memlib_shared_area(mem);
+    mm_heap_t *h;
+
+    if(sh == NULL) return NULL;
+#ifndef MM_PIC
+    if(sh->base != (uintptr_t)memlib_heap_lo(mem)) return NULL;
+#endif
+    if((h = heap_new(mem)) == NULL) return NULL;
+    heap_reset(h);
+    h->shared = sh;
+    return h;
+}
+
+/*
+ * mm_lock_h - take a shared heap's lock and pick up its current state
+ */
+void mm_lock_h(mm_heap_t *h)
+{
+    if(h->shared == NULL) return;
+    pthread_mutex_lock(&h->shared->lock);
+    memlib_sync_in(h->mem);
+    shared_load(h);
+}
+
+/*
+ * mm_unlock_h - publish what this process did to a shared heap and let
+ *     the next one in
+ */
+void mm_unlock_h(mm_heap_t *h)
+{
+    if(h->shared == NULL) return;
+    shared_store(h);
+    memlib_sync_out(h->mem);
+    pthread_mutex_unlock(&h->shared->lock);
+}
+
+//---------------------SNAPSHOTS------------------------------------
+//A snapshot file is a snap_hdr_t, padded to a page, followed by the heap's
+//bytes from memlib_heap_lo up to the brk, so restoring it is one mmap.
+//The header keeps pointers into the heap as offsets from its start (0 for
+//NULL, as no block starts there); the free-list links inside the heap stay
+//absolute and are shifted when the heap comes back somewhere else.
+#define SNAP_MAGIC "mmsnap1"
+
+typedef struct {
+    char magic[8];
+    uint64_t data;                      //file offset of the heap bytes
+    uint64_t base;                      //where the heap started
+    uint64_t heapsize;
+    uint64_t listp;                     //offset of heap_listp
+    uint64_t lists;                     //LIST_LIMT ...
+    uint64_t bucket_max[LIST_LIMT];     //... and the size classes it was built with
+    uint64_t seg_lists[LIST_LIMT];      //offsets of the list heads
+} snap_hdr_t;
+
+static int write_all(int fd, const void *buf, size_t n)
+{
+    ssize_t done;
+    while(n > 0){
+        if((done = write(fd, buf, n)) <= 0) return -1;
+        buf = (const char *)buf + done;
+        n -= done;
+    }
+    return 0;
+}
+
+/*
+ * mm_snapshot_h - save the heap to path. The file is written beside it
+ *     and renamed into place, so a heap still mapped from an older
+ *     snapshot at path keeps its pages. Returns -1 on an I/O error.
+ */
+int mm_snapshot_h(mm_heap_t *h, const char *path)
+{
+    char *lo = memlib_heap_lo(h->mem), tmp[4096];
+    size_t page = mem_pagesize();
+    snap_hdr_t hdr;
+    int fd, ok;
+
+    if(snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAP_MAGIC, sizeof(hdr.magic));
+    hdr.data = (sizeof(hdr) + page - 1) / page * page;
+    hdr.base = (uintptr_t)lo;
+    hdr.heapsize = memlib_heapsize(h->mem);
+    hdr.listp = h->heap_listp - lo;
+    hdr.lists = LIST_LIMT;
+    for(int i = 0; i < LIST_LIMT; i++){
+        hdr.bucket_max[i] = bucket_max[i];
+        hdr.seg_lists[i] = h->seg_lists[i] ? (char *)h->seg_lists[i] - lo : 0;
+    }
+
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) return -1;
+    ok = write_all(fd, &hdr, sizeof(hdr)) == 0 &&
+        lseek(fd, hdr.data, SEEK_SET) == (off_t)hdr.data &&
+        write_all(fd, lo, hdr.heapsize) == 0;
+    if(close(fd) < 0) ok = 0;
+    if(!ok || rename(tmp, path) < 0){
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+//reads and checks the header of the snapshot open on fd
+static int read_snap_hdr(int fd, snap_hdr_t *hdr)
+{
+    struct stat st;
+
+    if(read(fd, hdr, sizeof(*hdr)) != sizeof(*hdr)) return -1;
+    if(memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) != 0) return -1;
+    if(hdr->lists != LIST_LIMT) return -1;
+    for(int i = 0; i < LIST_LIMT; i++){
+        if(hdr->bucket_max[i] != bucket_max[i]) return -1;
+    }
+    if(hdr->data % mem_pagesize() != 0) return -1;
+    if(fstat(fd, &st) < 0 || (uint64_t)st.st_size < hdr->data + hdr->heapsize) return -1;
+    return 0;
+}
+
+//the heap came back delta bytes away from where it was saved: shift the
+//free-list links (the only pointers the allocator keeps inside the heap),
+//unless they are offsets already
+static void relocate(mm_heap_t *h, ptrdiff_t delta)
+{
+#ifndef MM_PIC
+    char *bp;
+    for(int i = 0; i < LIST_LIMT; i++){
+        for(bp = h->seg_lists[i]; bp != NULL; bp = GET_NEXT(bp)){
+            if(GET_NEXT(bp) != NULL) SET_NEXT(bp, GET_NEXT(bp) + delta);
+            if(GET_PREV(bp) != NULL) SET_PREV(bp, GET_PREV(bp) + delta);
+        }
+    }
+#endif
+}
+
+/*
+ * mm_restore_h - replace the heap with the snapshot at path, mapped
+ *     copy-on-write over the start of its memlib. If that isn't where the
+ *     snapshot was taken, the free lists are relocated, which touches
+ *     every free block; pointers the program stored in its own blocks
+ *     are then wrong, so such heaps need to come back at the same base
+ *     (see mm_open_snapshot). Returns -1, with the heap untouched, if
+ *     the file isn't a snapshot for this build or doesn't fit.
+ */
+int mm_restore_h(mm_heap_t *h, const char *path)
+{
+    snap_hdr_t hdr;
+    char *lo;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) return -1;
+    if(read_snap_hdr(fd, &hdr) < 0 || memlib_map_file(h->mem, fd, hdr.data, hdr.heapsize) < 0){
+        close(fd);
+        return -1;
+    }
+    close(fd); //the mapping keeps the file
+
+    heap_reset(h);
+    lo = memlib_heap_lo(h->mem);
+    h->heap_listp = lo + hdr.listp;
+    for(int i = 0; i < LIST_LIMT; i++){
+        h->seg_lists[i] = hdr.seg_lists[i] ? lo + hdr.seg_lists[i] : NULL;
+    }
+    if(lo != (char *)(uintptr_t)hdr.base) relocate(h, lo - (char *)(uintptr_t)hdr.base);
+    CHECK_CALL("mm_restore", NULL);
+    return 0;
+}
+
+/*
+ * mm_open_snapshot - restore the snapshot at path into a new memlib of
+ *     max_heap bytes, placed where the snapshot was taken if that range
+ *     is free. Returns the heap and sets *mem, or returns NULL.
+ */
+mm_heap_t *mm_open_snapshot(const char *path, size_t max_heap, memlib_t **mem)
+{
+    snap_hdr_t hdr;
+    mm_heap_t *h;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) return NULL;
+    if(read_snap_hdr(fd, &hdr) < 0){
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    if((*mem = memlib_create_at((void *)(uintptr_t)hdr.base, max_heap)) == NULL) return NULL;
+    if((h = heap_new(*mem)) == NULL || mm_restore_h(h, path) < 0){
+        free(h);
+        memlib_destroy(*mem);
+        return NULL;
+    }
+    return h;
+}
+
+//---------------------DEFAULT INSTANCE------------------------------
+
+/* 
+ * mm_init - initialize the malloc package.
+ */
+int mm_init(void)
+{
+    default_heap.mem = mem_default();
+    return mm_init_h(&default_heap);
+}
+
+void *mm_malloc(size_t size)
+{
+    return mm_malloc_inline(&default_heap, size);
+}
+
+void *mm_malloc_flags(size_t size, int flags)
+{
+    return mm_malloc_flags_h(&default_heap, size, flags);
+}
+
+int mm_set_placement(size_t line, int flags)
+{
+    return mm_set_placement_h(&default_heap, line, flags);
+}
+
+mm_handle_t mm_halloc(size_t size)
+{
+    return mm_halloc_h(&default_heap, size);
+}
+
+void *mm_hlock(mm_handle_t hd)
+{
+    return mm_hlock_h(&default_heap, hd);
+}
+
+void mm_hunlock(mm_handle_t hd)
+{
+    mm_hunlock_h(&default_heap, hd);
+}
+
+int mm_hrealloc(mm_handle_t hd, size_t size)
+{
+    return mm_hrealloc_h(&default_heap, hd, size);
+}
+
+void mm_hfree(mm_handle_t hd)
+{
+    mm_hfree_h(&default_heap, hd);
+}
+
+size_t mm_compact(void)
+{
+    return mm_compact_h(&default_heap);
+}
+
+void mm_compact_stats(mm_compact_stats_t *stats)
+{
+    mm_compact_stats_h(&default_heap, stats);
+}
+
+int mm_snapshot(const char *path)
+{
+    return mm_snapshot_h(&default_heap, path);
+}
+
+int mm_restore(const char *path)
+{
+    default_heap.mem = mem_default();
+    return mm_restore_h(&default_heap, path);
+}
+
+int mm_set_decay(long ms)
+{
+    return mm_set_decay_h(&default_heap, ms);
+}
+
+void mm_decay(void)
+{
+    mm_decay_h(&default_heap);
+}
+
+void mm_decay_stats(mm_decay_stats_t *stats)
+{
+    mm_decay_stats_h(&default_heap, stats);
+}
+
+int mm_set_profile(size_t rate)
+{
+    return mm_set_profile_h(&default_heap, rate);
+}
+
+int mm_profile_dump(const char *path)
+{
+    return mm_profile_dump_h(&default_heap, path);
+}
+
+void mm_profile_stats(mm_profile_stats_t *stats)
+{
+    mm_profile_stats_h(&default_heap, stats);
+}
+
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    return mm_calloc_h(&default_heap, nmemb, size);
+}
+
+void mm_free(void *ptr)
+{
+    mm_free_inline(&default_heap, ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return mm_realloc_h(&default_heap, ptr, size);
+}
+
+//---------------------HEAP INTROSPECTION----------------------------
+
+//number of segregated free lists
+int mm_num_buckets(void)
+{
+    return LIST_LIMT;
+}
+
+//visits every block from the prologue to the epilogue in address order
+void mm_walk_heap(mm_block_visit_t visit, void *arg)
+{
+    mm_heap_t *h = &default_heap;
+    char *bp;
+    for(bp = NEXT_BLKP(h->heap_listp); SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+        visit(bp, SIZE(HDRP(bp)), DSIZE, GET_ALLOC(HDRP(bp)), arg);
+    }
+}
+
+//visits every block on the segregated free lists, bucket by bucket
+void mm_walk_free(mm_free_visit_t visit, void *arg)
+{
+    mm_heap_t *h = &default_heap;
+    char *bp;
+    for(int i = 0; i < LIST_LIMT; i++){
+        for(bp = h->seg_lists[i]; bp != NULL; bp = GET_NEXT(bp)){
+            visit(i, bp, SIZE(HDRP(bp)), arg);
+        }
+    }
+}
+
+//---------------------CONSISTENCY CHECKS----------------------------
+
+static int in_heap(mm_heap_t *h, void *p)
+{
+    return (char *)p >= (char *)memlib_heap_lo(h->mem) && (char *)p <= (char *)memlib_heap_hi(h->mem);
+}
+
+//prologue and epilogue tags are intact (O(1))
+static const char *check_ends(mm_heap_t *h)
+{
+    if(GET(HDRP(h->heap_listp)) != PACK(DSIZE, 1) || GET(FTRP(h->heap_listp)) != PACK(DSIZE, 1))
+        return "prologue damaged";
+    if(GET((char *)memlib_heap_hi(h->mem) + 1 - WSIZE) != PACK(0, 1))
+        return "epilogue damaged";
+    return NULL;
+}
+
+//checks one block and, if it is free, its links (O(1)); returns the problem or NULL
+static const char *check_block(mm_heap_t *h, char *bp)
+{
+    size_t size = SIZE(HDRP(bp));
+    char *prev, *nxt;
+    int idx;
+
+    if((size_t)bp % ALIGNMENT) return "payload not aligned";
+    if(size < MINSIZE || size % DSIZE) return "bad block size";
+    if(!in_heap(h, HDRP(bp)) || !in_heap(h, FTRP(bp) + WSIZE - 1)) return "block runs outside the heap";
+    if(GET(HDRP(bp)) != GET(FTRP(bp))) return "header and footer disagree";
+    if(GET_ALLOC(HDRP(bp))) return NULL;
+
+    //free blocks: both neighbours allocated, and linked into bucket get_idx(size)
+    if(!GET_ALLOC(HDRP(LAST_BLKP(bp))) || !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+        return "adjacent free blocks were not coalesced";
+    idx = get_idx(size);
+    prev = GET_PREV(bp);
+    nxt = GET_NEXT(bp);
+    if(prev == NULL){
+        if(h->seg_lists[idx] != bp) return "list head is not in h->seg_lists[get_idx(size)]";
+    } else if(!in_heap(h, prev) || GET_NEXT(prev) != bp){
+        return "prev link inconsistent";
+    } else if(get_idx(SIZE(HDRP(prev))) != idx){
+        return "free list mixes buckets";
+    }
+    if(nxt != NULL){
+        if(!in_heap(h, nxt) || GET_PREV(nxt) != bp) return "next link inconsistent";
+        if(get_idx(SIZE(HDRP(nxt))) != idx) return "free list mixes buckets";
+    }
+    return NULL;
+}
+
+//the head cache holds the list's first blocks, in order, with their sizes
+static const char *check_head_cache(mm_heap_t *h, int list)
+{
+#if MM_HEAD_CACHE > 0
+    mm_head_cache_t *c = &h->heads[list];
+    char *bp = h->seg_lists[list];
+    if(c->n < 0 || c->n > MM_HEAD_CACHE) return "head cache count out of range";
+    for(int j = 0; j < c->n; j++, bp = GET_NEXT(bp)){
+        if(bp == NULL || c->bp[j] != bp) return "head cache out of step with its list";
+        if(c->size[j] != SIZE(HDRP(bp))) return "head cache has a stale size";
+    }
+#endif
+    return NULL;
+}
+
+static int is_zero(const char *p, size_t n)
+{
+    while(n > 0 && *p == 0){
+        p++;
+        n--;
+    }
+    return n == 0;
+}
+
+static int check_fail(const char *err, void *bp)
+{
+    fprintf(stderr, "mm_check: %s (block %p)\n", err, bp);
+    return -1;
+}
+
+/*
+ * mm_check_h - check the whole heap: every block, no free neighbours,
+ *     every free block on exactly the bucket get_idx says, the list links,
+ *     and the prologue/epilogue. Returns 0 if consistent, otherwise prints
+ *     the first problem to stderr and returns -1.
+ */
+int mm_check_h(mm_heap_t *h)
+{
+    const char *err;
+    char *bp;
+    size_t nfree = 0, nlisted = 0;
+
+    if((err = check_ends(h)) != NULL) return check_fail(err, h->heap_listp);
+    for(bp = NEXT_BLKP(h->heap_listp); SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)){
+        if((err = check_block(h, bp)) != NULL) return check_fail(err, bp);
+        if(!GET_ALLOC(HDRP(bp))){
+            nfree++;
+            if(HDRP(bp) >= h->clean_lo && !is_zero(bp + 2 * sizeof(char *), SIZE(HDRP(bp)) - MINSIZE))
+                return check_fail("never-used free block is not zero", bp);
+        }
+    }
+    if(HDRP(bp) != (char *)memlib_heap_hi(h->mem) + 1 - WSIZE)
+        return check_fail("epilogue is not at the end of the heap", bp);
+
+    //the walk above checked each free block's own bucket and links; counting
+    //the lists catches blocks that are missing, listed twice or in a cycle
+    for(int i = 0; i < LIST_LIMT; i++){
+        if((err = check_head_cache(h, i)) != NULL) return check_fail(err, h->seg_lists[i]);
+        for(bp = h->seg_lists[i]; bp != NULL; bp = GET_NEXT(bp)){
+            if(!in_heap(h, bp)) return check_fail("free list points outside the heap", bp);
+            if(GET_ALLOC(HDRP(bp))) return check_fail("allocated block on a free list", bp);
+            if(get_idx(SIZE(HDRP(bp))) != i) return check_fail("free block in the wrong bucket", bp);
+            if(++nlisted > nfree) return check_fail("free lists hold more blocks than the heap", bp);
+        }
+    }
+    if(nlisted != nfree) return check_fail("free block missing from the free lists", NULL);
+
+    //every live handle names an allocated block that names it back
+    for(int i = 1; i < h->nhandles; i++){
+        if((bp = h->handles[i].bp) == NULL) continue;
+        if(!in_heap(h, bp) || !GET_ALLOC(HDRP(bp))) return check_fail("handle to a block that isn't allocated", bp);
+        if(HANDLE_OF(bp) != i) return check_fail("handle block names another handle", bp);
+    }
+
+    //every live sample names an allocated block marked SAMPLED (another
+    //process can free a block of a shared heap behind the profile's back)
+    if(h->prof != NULL && h->shared == NULL){
+        for(int i = 0; i < PROF_BUCKETS; i++){
+            for(struct prof_sample *smp = h->prof->samples[i]; smp != NULL; smp = smp->next){
+                bp = smp->bp;
+                if(!in_heap(h, bp) || !GET_ALLOC(HDRP(bp)) || !(GET(HDRP(bp)) & SAMPLED))
+                    return check_fail("profile sample of a block that isn't sampled", bp);
+            }
+        }
+    }
+    return 0;
+}
+
+int mm_check(void)
+{
+    return mm_check_h(&default_heap);
+}
+
+//checks only bp and its two neighbours, i.e. what a single call can have touched
+static int check_touched(mm_heap_t *h, char *bp)
+{
+    const char *err;
+    char *blk[3];
+
+    if((err = check_ends(h)) != NULL) return check_fail(err, h->heap_listp);
+    if(bp == NULL) return 0;
+    blk[0] = LAST_BLKP(bp);
+    blk[1] = bp;
+    blk[2] = NEXT_BLKP(bp);
+    for(int i = 0; i < 3; i++){
+        if(blk[i] == h->heap_listp || SIZE(HDRP(blk[i])) == 0) continue; //prologue/epilogue
+        if((err = check_block(h, blk[i])) != NULL) return check_fail(err, blk[i]);
+    }
+    return 0;
+}
+
+//per-call hook: stop at the first call that leaves the heap inconsistent
+static void check_call(mm_heap_t *h, const char *op, void *bp)
+{
+    int ret = (check_mode == MM_CHECK_FULL) ? mm_check_h(h) : check_touched(h, bp);
+    if(ret < 0){
+        fprintf(stderr, "mm_check: heap inconsistent after %s\n", op);
+        abort();
+    }
+}
+
+/*
+ * mm_set_check - check the heap after every call, either fully or only
+ *     the touched blocks. Returns -1 if mm.c was built without -DMM_CHECK.
+ */
+int mm_set_check(int mode)
+{
+#ifdef MM_CHECK
+    check_mode = mode;
+    return 0;
+#else
+    (void)check_call;
+    return (mode == MM_CHECK_OFF) ? 0 : -1;
+#endif
+}
+
+//---------------------STATISTICS-----------------------------------
+
+/*
+ * mm_stats_dump - print the counters collected since the last mm_init.
+ *     Returns -1 if mm.c was built without -DMM_STATS.
+ */
+int mm_stats_dump(FILE *fp)
+{
+#ifdef MM_STATS
+    mm_heap_t *h = &default_heap;
+
+    fprintf(fp, "  calls:       %lu malloc, %lu free, %lu realloc "
+            "(malloc/free include %lu realloc copies)\n",
+            h->stats.mallocs, h->stats.frees, h->stats.reallocs, h->stats.realloc_copy);
+    fprintf(fp, "  find_fit:    %lu searches, %lu probes (%.2f per search), %lu from the head cache\n",
+            h->stats.fit_searches, h->stats.fit_probes,
+            h->stats.fit_searches ? (double)h->stats.fit_probes / h->stats.fit_searches : 0.0,
+            h->stats.fit_cached);
+    fprintf(fp, "  place:       %lu splits\n", h->stats.splits);
+    fprintf(fp, "  coalesce:    %lu merges\n", h->stats.coalesces);
+    fprintf(fp, "  extend_heap: %lu calls, %lu bytes\n", h->stats.extends, h->stats.extend_bytes);
+    fprintf(fp, "  exclusive:   %lu blocks, %lu bytes of line padding\n",
+            h->stats.exclusives, h->stats.exclusive_pad);
+    fprintf(fp, "  decay:       %lu bytes purged from %lu blocks, %lu free bytes not purged\n",
+            h->decay.released, h->decay.purges, h->decay.dirty);
+    fprintf(fp, "  calloc:      %lu calls, %lu from never-used memory (not cleared)\n",
+            h->stats.callocs, h->stats.calloc_fresh);
+    fprintf(fp, "  realloc:     %lu in place, %lu grown into next block, %lu copied\n",
+            h->stats.realloc_inplace, h->stats.realloc_grow, h->stats.realloc_copy);
+    fprintf(fp, "  %-12s%10s%12s%14s\n", "size class", "live blks", "live bytes", "peak bytes");
+    for(int i = 0; i < LIST_LIMT; i++){
+        if(h->stats.peak_bytes[i] == 0) continue;
+        fprintf(fp, "  %-12d%10lu%12lu%14lu\n", i,
+                h->stats.live_blocks[i], h->stats.live_bytes[i], h->stats.peak_bytes[i]);
+    }
+    return 0;
+#else
+    return -1;
+#endif
+}
@@ -1,6 +1,117 @@
+#ifndef __MM_H_
+#define __MM_H_
+
 #include <stdio.h>
 
+#include "memlib.h"
+
 extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_calloc(size_t nmemb, size_t size);
+
+/* Independent heaps; the functions above use a default instance */
+typedef struct mm_heap mm_heap_t;
+extern mm_heap_t *mm_create(memlib_t *mem);
+extern void mm_destroy(mm_heap_t *heap);
+extern int mm_init_h(mm_heap_t *heap);
+extern void *mm_malloc_h(mm_heap_t *heap, size_t size);
+extern void mm_free_h(mm_heap_t *heap, void *ptr);
+extern void *mm_realloc_h(mm_heap_t *heap, void *ptr, size_t size);
+extern void *mm_calloc_h(mm_heap_t *heap, size_t nmemb, size_t size);
+
+/* Cache-line exclusive placement, against false sharing between threads */
+#define MM_LINE 64		/* default cache line size */
+#define MM_EXCLUSIVE 0x1	/* no other payload shares the block's lines */
+extern void *mm_malloc_flags(size_t size, int flags);
+extern void *mm_malloc_flags_h(mm_heap_t *heap, size_t size, int flags);
+extern int mm_set_placement(size_t line, int flags);
+extern int mm_set_placement_h(mm_heap_t *heap, size_t line, int flags);
+
+/* Time-decay purging: free pages go back to the OS once they stay unused */
+typedef struct {
+    unsigned long released;	/* resident bytes handed back to the OS ... */
+    unsigned long purges;	/* ... from this many free blocks */
+    unsigned long dirty;	/* free bytes not purged at the last check */
+} mm_decay_stats_t;
+extern int mm_set_decay(long ms);
+extern int mm_set_decay_h(mm_heap_t *heap, long ms);
+extern void mm_decay(void);
+extern void mm_decay_h(mm_heap_t *heap);
+extern void mm_decay_stats(mm_decay_stats_t *stats);
+extern void mm_decay_stats_h(mm_heap_t *heap, mm_decay_stats_t *stats);
+
+/* Movable blocks, reached through handles; mm_compact slides the ones
+   not locked down to the bottom of the heap and shrinks the break */
+typedef int mm_handle_t;	/* 0 is never a valid handle */
+typedef struct {
+    unsigned long compactions;	/* compaction passes ... */
+    unsigned long moved;	/* ... the bytes they moved ... */
+    unsigned long released;	/* ... and the bytes the break shrank by */
+} mm_compact_stats_t;
+extern mm_handle_t mm_halloc(size_t size);
+extern mm_handle_t mm_halloc_h(mm_heap_t *heap, size_t size);
+extern void *mm_hlock(mm_handle_t handle);
+extern void *mm_hlock_h(mm_heap_t *heap, mm_handle_t handle);
+extern void mm_hunlock(mm_handle_t handle);
+extern void mm_hunlock_h(mm_heap_t *heap, mm_handle_t handle);
+extern int mm_hrealloc(mm_handle_t handle, size_t size);
+extern int mm_hrealloc_h(mm_heap_t *heap, mm_handle_t handle, size_t size);
+extern void mm_hfree(mm_handle_t handle);
+extern void mm_hfree_h(mm_heap_t *heap, mm_handle_t handle);
+extern size_t mm_compact(void);
+extern size_t mm_compact_h(mm_heap_t *heap);
+extern void mm_compact_stats(mm_compact_stats_t *stats);
+extern void mm_compact_stats_h(mm_heap_t *heap, mm_compact_stats_t *stats);
+
+/* Sampled heap profiling: about one allocation in every rate bytes is
+   recorded with its call stack, and mm_profile_dump writes the live and
+   total samples by call site as a pprof legacy heap profile */
+typedef struct {
+    unsigned long samples;	/* allocations sampled since mm_init ... */
+    unsigned long live;		/* ... those not freed yet ... */
+    unsigned long sites;	/* ... and the call stacks they came from */
+} mm_profile_stats_t;
+extern int mm_set_profile(size_t rate);
+extern int mm_set_profile_h(mm_heap_t *heap, size_t rate);
+extern int mm_profile_dump(const char *path);
+extern int mm_profile_dump_h(mm_heap_t *heap, const char *path);
+extern void mm_profile_stats(mm_profile_stats_t *stats);
+extern void mm_profile_stats_h(mm_heap_t *heap, mm_profile_stats_t *stats);
+
+/* Heaps shared by cooperating processes, on memlib_create_shared; hold
+   mm_lock_h around the calls on one (it is a no-op for other heaps) */
+extern mm_heap_t *mm_create_shared(memlib_t *mem);
+extern mm_heap_t *mm_attach_shared(memlib_t *mem);
+extern void mm_lock_h(mm_heap_t *heap);
+extern void mm_unlock_h(mm_heap_t *heap);
+
+/* Heap snapshots: save a heap to a file, and map it back in later */
+extern int mm_snapshot(const char *path);
+extern int mm_snapshot_h(mm_heap_t *heap, const char *path);
+extern int mm_restore(const char *path);
+extern int mm_restore_h(mm_heap_t *heap, const char *path);
+extern mm_heap_t *mm_open_snapshot(const char *path, size_t max_heap,
+				   memlib_t **mem);
+
+/* Heap introspection, used by the driver's heap analyzer */
+typedef void (*mm_block_visit_t)(void *bp, size_t size, size_t overhead,
+				 int alloc, void *arg);
+typedef void (*mm_free_visit_t)(int bucket, void *bp, size_t size, void *arg);
+extern int mm_num_buckets(void);
+extern void mm_walk_heap(mm_block_visit_t visit, void *arg);
+extern void mm_walk_free(mm_free_visit_t visit, void *arg);
+
+/* Heap consistency checks; the per-call modes need mm.c built with MM_CHECK */
+#define MM_CHECK_OFF  0
+#define MM_CHECK_INCR 1		/* check the blocks each call touched */
+#define MM_CHECK_FULL 2		/* check the whole heap after each call */
+extern int mm_check(void);
+extern int mm_check_h(mm_heap_t *heap);
+extern int mm_set_check(int mode);
+
+/* Allocator statistics, only collected when mm.c is built with MM_STATS */
+extern int mm_stats_dump(FILE *fp);
+
+#endif /* __MM_H_ */
@@ -0,0 +1,41 @@
+/*
+ * mm_buckets.h - Segregated list size classes for mm.c
+ *
+ * Generated by mkbuckets -l 20 -s 1024 from:
+ *   traces/amptjp-bal.rep
+ *   traces/binary-bal.rep
+ *   traces/binary2-bal.rep
+ *   traces/cccp-bal.rep
+ *   traces/coalescing-bal.rep
+ *   traces/cp-decl-bal.rep
+ *   traces/expr-bal.rep
+ *   traces/random-bal.rep
+ *   traces/random2-bal.rep
+ *   traces/realloc-bal.rep
+ *   traces/realloc2-bal.rep
+ *   traces/short1-bal.rep
+ *   traces/short2-bal.rep
+ * Do not edit; rerun "make buckets" instead.
+ */
+#define LIST_LIMT 20
+#define BUCKET_SMALL_MAX 1024
+
+/* Largest block size on each list; the last list is unbounded */
+static const size_t bucket_max[LIST_LIMT] = {
+    24, 64, 72, 96, 128, 152, 280, 456,
+    488, 1024, 2048, 4096, 8192, 16384, 32768, 65536,
+    131072, 262144, 524288, (size_t)-1
+};
+
+/* List of every block size up to BUCKET_SMALL_MAX, by size/8 */
+static const unsigned char bucket_small[BUCKET_SMALL_MAX/8 + 1] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 1, 2, 3, 3, 3, 4, 4, 4,
+    4, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 9, 9,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+    9
+};
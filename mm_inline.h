@@ -0,0 +1,339 @@
+/*
+ * mm_inline.h - Inline fast paths for mm_malloc and mm_free
+ *
+ * Most requests in the traces are small. A small malloc is nearly
+ * always served by the head of the first non-empty list at or above
+ * its size class, and a free often lands between two allocated blocks
+ * so that nothing coalesces. These static inline versions handle just
+ * those cases, with a size-class table lookup and a pop or push at a
+ * list head, and call the out-of-line slow paths in mm.c for
+ * everything else. A caller that includes this header (or any caller,
+ * when built with "make LTO=1") pays no function call for them.
+ *
+ * mm.c builds mm_malloc_h and mm_free_h on these functions, so the
+ * fast and slow paths always agree on the block layout. They pick the
+ * same blocks the slow path would, so utilization is unchanged. With
+ * MM_STATS or MM_CHECK the fast paths are compiled out so that every
+ * call is counted and checked.
+ */
+#ifndef __MM_INLINE_H_
+#define __MM_INLINE_H_
+
+#include <stddef.h>
+
+#include "mm.h"
+#include "mm_buckets.h"
+
+#if !defined(MM_STATS) && !defined(MM_CHECK)
+#define MM_INLINE_FAST
+#endif
+
+#define MM_MINSIZE 24          /* header + two links + footer */
+
+/*
+ * With "make HEADCACHE=<n>", each list keeps the sizes and addresses
+ * of its first n blocks in the heap struct, so a search that ends
+ * within them doesn't touch the blocks themselves. It is off by
+ * default: keeping the cache in step costs more on every push and pop
+ * than it saves, unless the lists are spread over more memory than the
+ * caches hold.
+ */
+#ifndef MM_HEAD_CACHE
+#define MM_HEAD_CACHE 0
+#endif
+
+/* Decay purging splits its window into this many epochs, and looks at
+   the clock once every MM_DECAY_CALLS mallocs and frees */
+#define MM_DECAY_EPOCHS 16
+#define MM_DECAY_CALLS 64
+
+#if MM_HEAD_CACHE > 0
+typedef struct {
+    int n;                              /* entries in use ... */
+    unsigned int size[MM_HEAD_CACHE];   /* ... the sizes ... */
+    char *bp[MM_HEAD_CACHE];            /* ... of the list's first n blocks */
+} mm_head_cache_t;
+#endif
+
+#ifdef MM_STATS
+typedef struct {
+    unsigned long mallocs, frees, reallocs;       /* calls per op */
+    unsigned long fit_searches, fit_probes;       /* find_fit calls and blocks looked at */
+    unsigned long fit_cached;                     /* probes answered by the head cache */
+    unsigned long splits, coalesces;              /* place splits and coalesce merges */
+    unsigned long extends, extend_bytes;          /* extend_heap calls and bytes */
+    unsigned long realloc_inplace, realloc_grow, realloc_copy; /* realloc outcomes */
+    unsigned long callocs, calloc_fresh;          /* calloc calls, and those not cleared */
+    unsigned long exclusives, exclusive_pad;      /* MM_EXCLUSIVE blocks and their padding */
+    unsigned long live_blocks[LIST_LIMT], live_bytes[LIST_LIMT]; /* allocated blocks by size class */
+    unsigned long peak_bytes[LIST_LIMT];          /* high-water mark of live_bytes */
+} mm_counters_t;
+#endif
+
+/* Everything one heap needs; see mm.c for how the blocks are laid out */
+struct mm_heap {
+    memlib_t *mem;                /* where the heap's memory comes from */
+    char *heap_listp;             /* prologue block */
+    void *seg_lists[LIST_LIMT];   /* segregated free lists */
+#if MM_HEAD_CACHE > 0
+    mm_head_cache_t heads[LIST_LIMT]; /* first blocks of each list */
+#endif
+    size_t line;                  /* cache line size for MM_EXCLUSIVE */
+    int place_flags;              /* MM_* flags applied to every malloc */
+    char *clean_lo;               /* no payload has reached this high yet, so
+				     from here up the heap is zero apart from
+				     free blocks' tags and links */
+    long decay_ms;                /* purge window, or -1 to never purge */
+    int decay_calls;              /* mallocs and frees since the last check */
+    long long epoch_end;          /* when the current epoch ends (ns) */
+    unsigned long freed;          /* bytes freed in the current epoch */
+    unsigned long backlog[MM_DECAY_EPOCHS]; /* bytes freed 1, 2, ... epochs ago */
+    mm_decay_stats_t decay;       /* what purging has done since mm_init */
+    struct mm_shared *shared;     /* state other processes see, for a heap
+				     made by mm_create_shared */
+    struct mm_hslot *handles;     /* handle table, slot 0 unused ... */
+    int nhandles, hcap;           /* ... slots in use or on the free chain,
+				     and allocated */
+    int hfree;                    /* first slot on the free chain, or 0 */
+    size_t hfreed;                /* bytes of handle blocks freed since the
+				     last compaction */
+    mm_compact_stats_t compact;   /* what compaction has done since mm_init */
+    long sample_left;             /* bytes to allocate before the next sample */
+    struct mm_profile *prof;      /* sampled allocations, or NULL when off */
+#ifdef MM_STATS
+    mm_counters_t stats;
+#endif
+};
+
+/* Out-of-line slow paths in mm.c */
+extern void *mm_malloc_slow(mm_heap_t *heap, size_t size);
+extern void mm_free_slow(mm_heap_t *heap, void *ptr);
+extern void mm_sample(mm_heap_t *heap, void *bp, size_t size);
+
+/* Block layout: 4-byte header and footer tags, free links in the payload */
+#define MMI_SAMPLED 0x2        /* tag bit: allocated block in the profile */
+#define MMI_TAG(p) (*(unsigned int *)(p))
+#define MMI_HDR(bp) MMI_TAG((char *)(bp) - 4)
+#define MMI_FTR(bp, size) MMI_TAG((char *)(bp) + (size) - 8)
+#define MMI_SIZE(bp) (MMI_HDR(bp) & ~0x7)
+#define MMI_NEXT(bp) mm_link(bp)
+#define MMI_PREV(bp) mm_link((char *)(bp) + 8)
+#define MMI_SET_NEXT(bp, to) mm_set_link(bp, to)
+#define MMI_SET_PREV(bp, to) mm_set_link((char *)(bp) + 8, to)
+
+/*
+ * mm_link, mm_set_link - read and write the free-list link stored at
+ *     field. With "make PIC=1" a link holds the distance from field to
+ *     the block it names (0 for none, as no link names itself), so the
+ *     lists stay valid wherever a shared heap is mapped.
+ */
+#ifdef MM_PIC
+static inline char *mm_link(void *field)
+{
+    ptrdiff_t d = *(ptrdiff_t *)field;
+    return d ? (char *)field + d : NULL;
+}
+
+static inline void mm_set_link(void *field, void *to)
+{
+    *(ptrdiff_t *)field = to ? (char *)to - (char *)field : 0;
+}
+#else
+static inline char *mm_link(void *field)
+{
+    return *(char **)field;
+}
+
+static inline void mm_set_link(void *field, void *to)
+{
+    *(char **)field = to;
+}
+#endif
+
+/*
+ * mm_adjust_size - block size for a payload of size bytes: room for
+ *     the header and footer, rounded up to 8, and at least MM_MINSIZE
+ */
+static inline size_t mm_adjust_size(size_t size)
+{
+    if (size <= 16)
+	return MM_MINSIZE;
+    return ((size + 7) & ~(size_t)0x7) + 8;
+}
+
+/*
+ * mm_size_class - segregated list for a block of size bytes; block
+ *     sizes are multiples of 8, so small ones index the table directly
+ */
+static inline int mm_size_class(size_t size)
+{
+    int list;
+
+    if (size <= BUCKET_SMALL_MAX)
+	return bucket_small[size >> 3];
+    list = bucket_small[BUCKET_SMALL_MAX >> 3] + 1;
+    while (list < LIST_LIMT - 1 && size > bucket_max[list])
+	list++;
+    return list;
+}
+
+/*
+ * mm_cache_push - bp, of size bytes, is now the head of list
+ */
+static inline void mm_cache_push(mm_heap_t *h, int list, char *bp, size_t size)
+{
+#if MM_HEAD_CACHE > 0
+    mm_head_cache_t *c = &h->heads[list];
+    int i = (c->n < MM_HEAD_CACHE) ? c->n++ : MM_HEAD_CACHE - 1;
+
+    for (; i > 0; i--) {
+	c->size[i] = c->size[i - 1];
+	c->bp[i] = c->bp[i - 1];
+    }
+    c->size[0] = size;
+    c->bp[0] = bp;
+#endif
+}
+
+/*
+ * mm_cache_drop - bp is coming off list; the entries after it move up,
+ *     so the cache still holds the first blocks of the list
+ */
+static inline void mm_cache_drop(mm_heap_t *h, int list, char *bp)
+{
+#if MM_HEAD_CACHE > 0
+    mm_head_cache_t *c = &h->heads[list];
+    int i;
+
+    for (i = 0; i < c->n; i++) {
+	if (c->bp[i] == bp) {
+	    for (c->n--; i < c->n; i++) {
+		c->size[i] = c->size[i + 1];
+		c->bp[i] = c->bp[i + 1];
+	    }
+	    return;
+	}
+    }
+#endif
+}
+
+/*
+ * mm_head_size - size of bp, the head of list, from the cache if it can
+ */
+static inline size_t mm_head_size(mm_heap_t *h, int list, char *bp)
+{
+#if MM_HEAD_CACHE > 0
+    if (h->heads[list].n > 0)
+	return h->heads[list].size[0];
+#endif
+    return MMI_SIZE(bp);
+}
+
+/*
+ * mm_mark_used - the caller may now write all of bp's payload, so it
+ *     no longer counts as never-used memory
+ */
+static inline void mm_mark_used(mm_heap_t *h, char *bp, size_t size)
+{
+    if (bp + size - 4 > h->clean_lo)
+	h->clean_lo = bp + size - 4;
+}
+
+/*
+ * mm_decay_tick - count a malloc or free towards the next decay check,
+ *     so a program that stays on the fast paths still purges
+ */
+static inline void mm_decay_tick(mm_heap_t *h)
+{
+    if (h->decay_ms >= 0 && ++h->decay_calls >= MM_DECAY_CALLS)
+	mm_decay_h(h);
+}
+
+/*
+ * mm_push_free - put free block bp at the head of its list
+ */
+static inline void mm_push_free(mm_heap_t *h, char *bp, size_t size)
+{
+    int list = mm_size_class(size);
+    char **head = (char **)&h->seg_lists[list];
+
+    mm_cache_push(h, list, bp, size);
+
+    MMI_SET_NEXT(bp, *head);
+    MMI_SET_PREV(bp, NULL);
+    if (*head != NULL)
+	MMI_SET_PREV(*head, bp);
+    *head = bp;
+}
+
+/*
+ * mm_malloc_inline - take the head of the first non-empty list from
+ *     size's own class up, splitting off any usable remainder, unless
+ *     the head of the own class is too small; that case, and large
+ *     requests, go to the slow path. This is the block find_fit would
+ *     have picked.
+ */
+static inline void *mm_malloc_inline(mm_heap_t *h, size_t size)
+{
+#ifdef MM_INLINE_FAST
+    /* 1 <= size, the block still falls in the small table, and it
+       needs no special placement */
+    if (size - 1 < BUCKET_SMALL_MAX - 8 && h->place_flags == 0) {
+	size_t asize = mm_adjust_size(size), bsize, rsize;
+	int list = bucket_small[asize >> 3];
+	char **head, *bp, *next, *rp;
+
+	while (list < LIST_LIMT - 1 && h->seg_lists[list] == NULL)
+	    list++;
+	head = (char **)&h->seg_lists[list];
+	if ((bp = *head) != NULL && (bsize = mm_head_size(h, list, bp)) >= asize) {
+	    mm_cache_drop(h, list, bp);
+	    next = MMI_NEXT(bp);
+	    *head = next;
+	    if (next != NULL)
+		MMI_SET_PREV(next, NULL);
+	    if ((rsize = bsize - asize) >= MM_MINSIZE) {
+		bsize = asize;
+		rp = bp + asize;
+		MMI_HDR(rp) = rsize | (MMI_HDR(bp) & 0x4); /* still purged */
+		MMI_FTR(rp, rsize) = MMI_HDR(rp);
+		mm_push_free(h, rp, rsize);
+	    }
+	    MMI_HDR(bp) = bsize | 1;
+	    MMI_FTR(bp, bsize) = bsize | 1;
+	    mm_mark_used(h, bp, bsize);
+	    if ((h->sample_left -= size) < 0)
+		mm_sample(h, bp, size);
+	    mm_decay_tick(h);
+	    return bp;
+	}
+    }
+#endif
+    return mm_malloc_slow(h, size);
+}
+
+/*
+ * mm_free_inline - push a block with two allocated neighbours onto
+ *     the head of its class, else take the slow path to coalesce (or
+ *     to take a sampled block out of the profile)
+ */
+static inline void mm_free_inline(mm_heap_t *h, void *ptr)
+{
+#ifdef MM_INLINE_FAST
+    size_t size = MMI_SIZE(ptr);
+    char *bp = ptr;
+
+    if (!(MMI_HDR(bp) & MMI_SAMPLED) &&
+	(MMI_TAG(bp - 8) & 0x1) && (MMI_TAG(bp + size - 4) & 0x1)) {
+	h->freed += size;
+	MMI_HDR(bp) = size;
+	MMI_FTR(bp, size) = size;
+	mm_push_free(h, bp, size);
+	mm_decay_tick(h);
+	return;
+    }
+#endif
+    mm_free_slow(h, ptr);
+}
+
+#endif /* __MM_INLINE_H_ */
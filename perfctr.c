@@ -0,0 +1,130 @@
+/*
+ * perfctr.c - Count hardware events with Linux perf_event_open(2)
+ *
+ * Each event is opened as its own counter rather than as one group, so
+ * that events the CPU or a virtual machine does not support only leave
+ * a hole in the report instead of disabling all counting. Counters are
+ * user-space only, which is allowed at the default paranoia level, and
+ * are scaled by time_enabled/time_running when the kernel has to
+ * multiplex them.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "perfctr.h"
+
+char *perf_names[PERF_NCOUNTERS] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "br-miss", "dTLB-miss"
+};
+
+static int fds[PERF_NCOUNTERS] = {-1, -1, -1, -1, -1, -1};
+
+#ifdef __linux__
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The perf_event_attr type and config of each event */
+static struct {
+    unsigned type;
+    unsigned long long config;
+} events[PERF_NCOUNTERS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+/* 
+ * perf_open - Open one disabled, user-space-only counter per event 
+ */
+int perf_open(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | 
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    return n;
+}
+
+/* 
+ * perf_measure - Count the events during one call of f(argp) 
+ */
+void perf_measure(perf_test_funct f, void *argp, perf_counts_t *counts)
+{
+    unsigned long long buf[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] >= 0) {
+	    ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+    f(argp);
+    for (i = 0; i < PERF_NCOUNTERS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	counts->valid[i] = 0;
+	counts->count[i] = 0;
+	if (fds[i] < 0 || read(fds[i], buf, sizeof(buf)) != sizeof(buf) ||
+	    buf[2] == 0)
+	    continue;
+	counts->valid[i] = 1;
+	counts->count[i] = (double)buf[0] * buf[1] / buf[2];
+    }
+}
+
+#else /* !__linux__ */
+
+int perf_open(void)
+{
+    return 0;
+}
+
+void perf_measure(perf_test_funct f, void *argp, perf_counts_t *counts)
+{
+    memset(counts, 0, sizeof(perf_counts_t));
+    f(argp);
+}
+
+#endif
+
+/* 
+ * perf_close - Close the counters 
+ */
+void perf_close(void)
+{
+    int i;
+
+    for (i = 0; i < PERF_NCOUNTERS; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	fds[i] = -1;
+    }
+}
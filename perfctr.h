@@ -0,0 +1,43 @@
+/*
+ * perfctr.h - prototypes for the hardware performance counter routines
+ *     in perfctr.c
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/* The events that perfctr.c counts */
+#define PERF_CYCLES        0  /* CPU cycles */
+#define PERF_INSTRUCTIONS  1  /* instructions retired */
+#define PERF_L1D_MISSES    2  /* L1 data cache read misses */
+#define PERF_LLC_MISSES    3  /* last level cache misses */
+#define PERF_BRANCH_MISSES 4  /* mispredicted branches */
+#define PERF_DTLB_MISSES   5  /* data TLB read misses */
+#define PERF_NCOUNTERS     6
+
+/* The test function takes a generic pointer as input */
+typedef void (*perf_test_funct)(void *);
+
+/* The counts for one measured call */
+typedef struct {
+    int valid[PERF_NCOUNTERS];     /* could this event be counted? */
+    double count[PERF_NCOUNTERS];  /* event counts, scaled if multiplexed */
+} perf_counts_t;
+
+/* Short column names for each event */
+extern char *perf_names[PERF_NCOUNTERS];
+
+/* 
+ * Open the counters for the calling process. Returns the number of 
+ * events that can be counted, which is 0 if the kernel or the 
+ * permissions (see /proc/sys/kernel/perf_event_paranoid) do not allow
+ * any of them. 
+ */
+int perf_open(void);
+
+/* Count the events during one call of f(argp) */
+void perf_measure(perf_test_funct f, void *argp, perf_counts_t *counts);
+
+/* Close the counters */
+void perf_close(void);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,292 @@
+/*
+ * checktrace.c - trace file consistency checker and balancer
+ *
+ * Usage: checktrace [-hsv] < tracefile > balanced-tracefile
+ *
+ * Reads a Malloc Lab trace, checks it for consistency, and outputs a
+ * balanced version by appending a free request for every block that
+ * is still allocated at the end. Output is byte-for-byte what the old
+ * checktrace.pl produced, but the trace is streamed in a single pass
+ * with one state byte and one size word per request id instead of a
+ * hash and a copy of every line, so multi-GB traces are no problem.
+ *
+ * Along the way it gathers trace statistics (op mix, peak live
+ * blocks and bytes, and a histogram of request sizes), which -v
+ * prints to stderr.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define MAXLINE 1024
+#define NUM_CLASSES 32		/* size histogram: <=1, <=2, <=4, ... bytes */
+
+/* Per-id state, one byte each */
+#define ID_NONE 0		/* never allocated, or freed */
+#define ID_ALLOC 'a'		/* allocated by an "a" or "c" request ... */
+#define ID_REALLOC 'r'		/* ... and last resized by an "r" request */
+
+static char *state;		/* state[id] */
+static unsigned *sizes;		/* sizes[id] = current size of a live id */
+static unsigned long cap;	/* size of the two arrays above */
+
+/* Statistics */
+static unsigned long ops[4];	/* a, r, f, c requests */
+static unsigned long live_blocks, peak_blocks;
+static unsigned long long live_bytes, peak_bytes;
+static unsigned long size_hist[NUM_CLASSES];
+
+static char *prog;
+
+static void usage(void);
+static void unix_error(char *msg);
+
+/*
+ * trace_error - Report an inconsistency the way checktrace.pl did and exit
+ */
+static void trace_error(long linenum, char *msg)
+{
+    if (linenum > 0)
+	fprintf(stderr, "%s: ERROR[%ld]: %s\n", prog, linenum, msg);
+    else
+	fprintf(stderr, "%s: ERROR: %s\n", prog, msg);
+    exit(1);
+}
+
+/*
+ * grow - Make room for request id id in the id table
+ */
+static void grow(unsigned long id)
+{
+    unsigned long newcap = cap ? cap : 1024;
+
+    while (newcap <= id)
+	newcap *= 2;
+    if ((state = realloc(state, newcap)) == NULL ||
+	(sizes = realloc(sizes, newcap * sizeof(unsigned))) == NULL)
+	unix_error("realloc failed in grow");
+    memset(state + cap, ID_NONE, newcap - cap);
+    cap = newcap;
+}
+
+static void record_size(unsigned size)
+{
+    int c = 0;
+
+    while (c < NUM_CLASSES - 1 && ((unsigned long long)1 << c) < size)
+	c++;
+    size_hist[c]++;
+}
+
+/*
+ * idcmp - Order ids as strings, as checktrace.pl's "sort keys" did
+ */
+static int idcmp(const void *a, const void *b)
+{
+    char sa[32], sb[32];
+
+    sprintf(sa, "%lu", *(unsigned long *)a);
+    sprintf(sb, "%lu", *(unsigned long *)b);
+    return strcmp(sa, sb);
+}
+
+static void print_stats(int balanced)
+{
+    unsigned long total = ops[0] + ops[1] + ops[2] + ops[3];
+    int c;
+
+    fprintf(stderr, "%s: %lu requests: %lu alloc (%.1f%%), %lu calloc (%.1f%%), "
+	    "%lu realloc (%.1f%%), %lu free (%.1f%%)\n", prog, total,
+	    ops[0], total ? 100.0 * ops[0] / total : 0,
+	    ops[3], total ? 100.0 * ops[3] / total : 0,
+	    ops[1], total ? 100.0 * ops[1] / total : 0,
+	    ops[2], total ? 100.0 * ops[2] / total : 0);
+    fprintf(stderr, "%s: peak live %lu blocks, %llu bytes; %lu left allocated%s\n",
+	    prog, peak_blocks, peak_bytes, live_blocks,
+	    balanced ? "" : " (freed at the end of the output)");
+    fprintf(stderr, "%s: alloc/calloc/realloc sizes:\n", prog);
+    for (c = 0; c < NUM_CLASSES; c++) {
+	if (size_hist[c] == 0)
+	    continue;
+	fprintf(stderr, "  <= %10llu  %10lu  %5.1f%%\n",
+		(unsigned long long)1 << c, size_hist[c],
+		100.0 * size_hist[c] / (ops[0] + ops[1] + ops[3]));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char line[MAXLINE], hdr[4][MAXLINE];
+    char cmd[MAXLINE];
+    unsigned long id, size, old_num_ops, num_ids, *residue, n, i;
+    long linenum = 0;
+    int summary = 0, verbose = 0, c, fields, seekable;
+    char numbuf[32];
+    long num_ops_pos = 0, width = 0;
+    FILE *out = stdout;
+
+    prog = argv[0];
+    while ((c = getopt(argc, argv, "hsv")) != -1) {
+	switch (c) {
+	case 's': /* Emit only a brief summary */
+	    summary = 1;
+	    break;
+	case 'v': /* Print trace statistics to stderr */
+	    verbose = 1;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    setvbuf(stdin, NULL, _IOFBF, 1 << 20);
+    setvbuf(stdout, NULL, _IOFBF, 1 << 20);
+
+    /* Read the trace header values */
+    for (i = 0; i < 4; i++) {
+	if (fgets(hdr[i], MAXLINE, stdin) == NULL)
+	    trace_error(0, "truncated trace header");
+	hdr[i][strcspn(hdr[i], "\r\n")] = '\0';
+	linenum++;
+    }
+    num_ids = strtoul(hdr[1], NULL, 10);
+    old_num_ops = strtoul(hdr[2], NULL, 10);
+    if (num_ids > 0)
+	grow(num_ids - 1);
+
+    /*
+     * The balanced request count is only known at the end. It is at
+     * most old_num_ops + num_ids, so leave room for that many digits
+     * and patch the header in place; when the output can't seek (a
+     * pipe, or a file opened for appending), spool the requests through
+     * a temporary file instead.
+     */
+    seekable = !summary && fseek(stdout, 0, SEEK_CUR) == 0 &&
+	!(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND);
+    if (!summary) {
+	width = sprintf(numbuf, "%lu", old_num_ops + num_ids);
+	printf("%s\n%s\n", hdr[0], hdr[1]);
+	if (seekable) {
+	    num_ops_pos = ftell(stdout);
+	    printf("%-*lu\n%s\n", (int)width, old_num_ops, hdr[3]);
+	}
+	else if ((out = tmpfile()) == NULL)
+	    unix_error("tmpfile failed");
+    }
+
+    /* Check every request, echoing it to the output */
+    while (fgets(line, MAXLINE, stdin) != NULL) {
+	linenum++;
+	fields = sscanf(line, "%s %lu %lu", cmd, &id, &size);
+
+	/* ignore blank lines */
+	if (fields < 1)
+	    continue;
+	if (fields < 2 || (cmd[0] != 'f' && fields < 3) || cmd[1] != '\0')
+	    trace_error(linenum, "malformed request");
+	if (!summary) {
+	    line[strcspn(line, "\r\n")] = '\0';
+	    fprintf(out, "%s\n", line);
+	}
+	if (id >= cap)
+	    grow(id);
+
+	switch (cmd[0]) {
+	case 'r':
+	    if (state[id] == ID_NONE)
+		trace_error(linenum, "realloc without previous alloc");
+	    ops[1]++;
+	    live_bytes += size;
+	    live_bytes -= sizes[id];
+	    sizes[id] = size;
+	    state[id] = ID_REALLOC;
+	    record_size(size);
+	    break;
+	case 'a':
+	case 'c':
+	    if (state[id] != ID_NONE)
+		trace_error(linenum, "allocate with no intervening free.");
+	    ops[cmd[0] == 'c' ? 3 : 0]++;
+	    live_blocks++;
+	    live_bytes += size;
+	    sizes[id] = size;
+	    state[id] = ID_ALLOC;
+	    record_size(size);
+	    break;
+	case 'f':
+	    if (state[id] == ID_NONE)
+		trace_error(linenum, "freeing unallocated block.");
+	    ops[2]++;
+	    live_blocks--;
+	    live_bytes -= sizes[id];
+	    state[id] = ID_NONE;
+	    break;
+	default:
+	    trace_error(linenum, "bogus request type");
+	}
+	if (live_blocks > peak_blocks)
+	    peak_blocks = live_blocks;
+	if (live_bytes > peak_bytes)
+	    peak_bytes = live_bytes;
+    }
+    if (ferror(stdin))
+	unix_error("read failed");
+
+    if (verbose)
+	print_stats(live_blocks == 0);
+
+    /* If called with -s, print a brief balance summary and exit */
+    if (summary) {
+	printf(live_blocks == 0 ? "Balanced trace.\n" : "Unbalanced trace.\n");
+	exit(0);
+    }
+
+    /* Append the free requests that balance the trace */
+    if ((residue = malloc((live_blocks + 1) * sizeof(unsigned long))) == NULL)
+	unix_error("malloc failed in main");
+    for (id = 0, n = 0; id < cap; id++)
+	if (state[id] != ID_NONE)
+	    residue[n++] = id;
+    qsort(residue, n, sizeof(unsigned long), idcmp);
+    for (i = 0; i < n; i++)
+	fprintf(out, "f %lu\n", residue[i]);
+
+    /* Fill in the balanced request count */
+    sprintf(numbuf, "%lu", old_num_ops + n);
+    if (seekable) {
+	if (fseek(stdout, num_ops_pos, SEEK_SET) < 0)
+	    unix_error("fseek failed");
+	printf("%-*s", (int)width, numbuf);
+    }
+    else {
+	size_t len;
+
+	printf("%s\n%s\n", numbuf, hdr[3]);
+	rewind(out);
+	while ((len = fread(line, 1, MAXLINE, out)) > 0)
+	    fwrite(line, 1, len, stdout);
+    }
+    if (fflush(stdout) != 0)
+	unix_error("write failed");
+    exit(0);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: %s [-hsv] < tracefile > balanced-tracefile\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -h          Print this message\n");
+    fprintf(stderr, "  -s          Emit only a brief summary\n");
+    fprintf(stderr, "  -v          Print trace statistics to stderr\n");
+}
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
@@ -0,0 +1,497 @@
+/*
+ * gen_trace.c - Synthesize large traces from a workload profile
+ *
+ * Usage: gen_trace [-b] [-s <seed>] -o <tracefile> <profile>
+ *
+ * Unlike the gen_XXX.pl scripts, which each hard-code one pattern,
+ * gen_trace reads a profile describing the workload and streams the
+ * trace straight to disk, so traces of 100M requests take seconds.
+ * With -b the output is a binary trace (see ../bintrace.h), which
+ * mdriver reads much faster than .rep text.
+ *
+ * A profile is a list of "key args" lines; '#' starts a comment:
+ *
+ *   seed <n>                 random seed (overridden by -s)
+ *   ops <n>                  number of requests in the current phase
+ *   live <n>                 upper bound on the number of live blocks
+ *   size <dist>              request size in bytes
+ *   lifetime <dist>          block lifetime in requests
+ *   realloc <p> <factor>     each request is, with probability p, a
+ *                            realloc of a random live block to
+ *                            factor times its current size
+ *   calloc <p>               each allocation is, with probability p,
+ *                            a calloc
+ *   maxsize <n>              clamp sizes (and realloc growth) to n
+ *   phase                    start a new phase; it inherits every
+ *                            setting of the previous one
+ *
+ * where <dist> is one of
+ *
+ *   const <v>
+ *   uniform <lo> <hi>
+ *   exp <mean>
+ *   lognormal <median> <sigma>
+ *   choice <v>:<weight> ...  (up to 32 values)
+ *
+ * Each request frees the block whose lifetime has expired first, if
+ * any; otherwise it is a realloc with probability p, an allocation if
+ * fewer than <live> blocks are live, and a free of the block due
+ * soonest if not. The trace ends by freeing every live block, so it is
+ * always balanced. Request ids are reused once freed, which keeps
+ * num_ids (and mdriver's tables) proportional to the live set.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../bintrace.h"
+
+#define MAXLINE 1024
+#define MAXCHOICE 32
+#define MAXPHASES 64
+
+/* A random distribution read from the profile */
+typedef struct {
+    enum {CONST, UNIFORM, EXP, LOGNORMAL, CHOICE} kind;
+    double a, b;                /* parameters of the first four kinds */
+    int n;                      /* number of choices */
+    double v[MAXCHOICE];        /* choice values ... */
+    double w[MAXCHOICE];        /* ... and cumulative weights */
+} dist_t;
+
+/* The settings of one phase of the workload */
+typedef struct {
+    long ops;                   /* number of requests */
+    long live;                  /* max live blocks */
+    dist_t size;                /* request sizes */
+    dist_t lifetime;            /* block lifetimes, in requests */
+    double realloc_p;           /* probability of a realloc */
+    double realloc_factor;      /* realloc size multiplier */
+    double calloc_p;            /* probability an allocation is a calloc */
+    unsigned maxsize;           /* size clamp */
+} phase_t;
+
+/* A live block, kept in a min-heap ordered by time of death */
+typedef struct {
+    unsigned long long death;   /* request number at which to free it */
+    unsigned id;                /* its request id */
+} block_t;
+
+static phase_t phases[MAXPHASES];
+static int num_phases;
+static unsigned long long rng_state = 88172645463325252ULL;
+
+/* The live set */
+static block_t *heap;           /* min-heap of live blocks */
+static long *heap_pos;          /* heap_pos[id] = slot of id in heap */
+static unsigned *sizes;         /* sizes[id] = current size of id */
+static unsigned *free_ids;      /* stack of ids that can be reused */
+static long num_live, num_free_ids, max_live;
+static unsigned num_ids;
+
+/* Output */
+static FILE *out;
+static int binary;
+static long num_ops;
+static unsigned long long live_bytes, peak_bytes;
+
+static void usage(void);
+static void app_error(char *msg);
+static void unix_error(char *msg);
+
+/*
+ * rnd - xorshift64* uniform double in [0,1)
+ */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * sample - Draw a value from a distribution
+ */
+static double sample(dist_t *d)
+{
+    double u, r;
+    int i;
+
+    switch (d->kind) {
+    case CONST:
+	return d->a;
+    case UNIFORM:
+	return d->a + (d->b - d->a) * rnd();
+    case EXP:
+	return -d->a * log(1.0 - rnd());
+    case LOGNORMAL:
+	/* Box-Muller */
+	u = 1.0 - rnd();
+	r = sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * rnd());
+	return d->a * exp(d->b * r);
+    case CHOICE:
+	u = rnd() * d->w[d->n - 1];
+	for (i = 0; i < d->n - 1 && u >= d->w[i]; i++)
+	    ;
+	return d->v[i];
+    }
+    return 0;
+}
+
+/*
+ * parse_dist - Parse "<kind> <args>" into a distribution
+ */
+static void parse_dist(char *args, dist_t *d, int lineno)
+{
+    char kind[MAXLINE], *tok;
+    double total = 0;
+    int n;
+
+    if (sscanf(args, "%s%n", kind, &n) != 1)
+	goto bad;
+    args += n;
+    if (!strcmp(kind, "const")) {
+	d->kind = CONST;
+	if (sscanf(args, "%lf", &d->a) != 1)
+	    goto bad;
+    }
+    else if (!strcmp(kind, "uniform")) {
+	d->kind = UNIFORM;
+	if (sscanf(args, "%lf %lf", &d->a, &d->b) != 2)
+	    goto bad;
+    }
+    else if (!strcmp(kind, "exp")) {
+	d->kind = EXP;
+	if (sscanf(args, "%lf", &d->a) != 1)
+	    goto bad;
+    }
+    else if (!strcmp(kind, "lognormal")) {
+	d->kind = LOGNORMAL;
+	if (sscanf(args, "%lf %lf", &d->a, &d->b) != 2)
+	    goto bad;
+    }
+    else if (!strcmp(kind, "choice")) {
+	d->kind = CHOICE;
+	d->n = 0;
+	for (tok = strtok(args, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+	    double w;
+	    if (d->n == MAXCHOICE || sscanf(tok, "%lf:%lf", &d->v[d->n], &w) != 2)
+		goto bad;
+	    total += w;
+	    d->w[d->n++] = total;
+	}
+	if (d->n == 0 || total <= 0)
+	    goto bad;
+    }
+    else
+	goto bad;
+    return;
+
+ bad:
+    fprintf(stderr, "gen_trace: bad distribution on profile line %d\n", lineno);
+    exit(1);
+}
+
+/*
+ * read_profile - Read the phases of a profile
+ */
+static void read_profile(char *filename)
+{
+    FILE *fp;
+    char line[MAXLINE], key[MAXLINE], *args, *p;
+    phase_t *ph;
+    int lineno = 0, n;
+    unsigned long long seed;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+	unix_error("Could not open profile");
+
+    /* Defaults for the first phase */
+    ph = &phases[0];
+    num_phases = 1;
+    ph->ops = 100000;
+    ph->live = 1000;
+    ph->size.kind = UNIFORM;
+    ph->size.a = 1;
+    ph->size.b = 1024;
+    ph->lifetime.kind = EXP;
+    ph->lifetime.a = 1000;
+    ph->realloc_p = 0;
+    ph->realloc_factor = 1.5;
+    ph->calloc_p = 0;
+    ph->maxsize = 1 << 20;
+
+    while (fgets(line, MAXLINE, fp) != NULL) {
+	lineno++;
+	if ((p = strchr(line, '#')) != NULL)
+	    *p = '\0';
+	if (sscanf(line, "%s%n", key, &n) != 1)
+	    continue;
+	args = line + n;
+	if (!strcmp(key, "phase")) {
+	    if (num_phases == MAXPHASES)
+		app_error("Too many phases in profile");
+	    phases[num_phases] = *ph;
+	    ph = &phases[num_phases++];
+	}
+	else if (!strcmp(key, "seed") && sscanf(args, "%llu", &seed) == 1)
+	    rng_state = seed ? seed : rng_state;
+	else if (!strcmp(key, "ops") && sscanf(args, "%ld", &ph->ops) == 1)
+	    ;
+	else if (!strcmp(key, "live") && sscanf(args, "%ld", &ph->live) == 1)
+	    ;
+	else if (!strcmp(key, "maxsize") && sscanf(args, "%u", &ph->maxsize) == 1)
+	    ;
+	else if (!strcmp(key, "realloc") &&
+		 sscanf(args, "%lf %lf", &ph->realloc_p, &ph->realloc_factor) == 2)
+	    ;
+	else if (!strcmp(key, "calloc") && sscanf(args, "%lf", &ph->calloc_p) == 1)
+	    ;
+	else if (!strcmp(key, "size"))
+	    parse_dist(args, &ph->size, lineno);
+	else if (!strcmp(key, "lifetime"))
+	    parse_dist(args, &ph->lifetime, lineno);
+	else {
+	    fprintf(stderr, "gen_trace: bad line %d in %s\n", lineno, filename);
+	    exit(1);
+	}
+	if (ph->live < 1 || ph->ops < 0 || ph->maxsize < 1)
+	    app_error("ops, live and maxsize must be positive");
+    }
+    fclose(fp);
+
+    for (n = 0; n < num_phases; n++)
+	if (phases[n].live > max_live)
+	    max_live = phases[n].live;
+}
+
+/*
+ * emit - Write one request
+ */
+static void emit(char type, unsigned id, unsigned size)
+{
+    if (binary) {
+	bintrace_op_t op;
+	memset(&op, 0, sizeof(op));
+	op.type = type;
+	op.index = id;
+	op.size = size;
+	if (fwrite(&op, sizeof(op), 1, out) != 1)
+	    unix_error("Write failed");
+    }
+    else if (type == 'f')
+	fprintf(out, "f %u\n", id);
+    else
+	fprintf(out, "%c %u %u\n", type, id, size);
+    num_ops++;
+}
+
+/*
+ * write_header - Write (or, at the end, rewrite) the trace header
+ */
+static void write_header(void)
+{
+    if (fseek(out, 0, SEEK_SET) < 0)
+	unix_error("Output must be a seekable file");
+    if (binary) {
+	bintrace_hdr_t hdr;
+	memcpy(hdr.magic, BINTRACE_MAGIC, sizeof(hdr.magic));
+	hdr.sugg_heapsize = peak_bytes > 0x7fffffff ? 0x7fffffff : peak_bytes;
+	hdr.num_ids = num_ids;
+	hdr.num_ops = num_ops;
+	hdr.weight = 1;
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	    unix_error("Write failed");
+    }
+    else {
+	/* Fixed width, so the final values fit over the placeholders */
+	fprintf(out, "%-11llu\n%-11u\n%-11ld\n%-11d\n",
+		peak_bytes, num_ids, num_ops, 1);
+    }
+}
+
+/* Min-heap on death time */
+static void heap_swap(long i, long j)
+{
+    block_t t = heap[i];
+    heap[i] = heap[j];
+    heap[j] = t;
+    heap_pos[heap[i].id] = i;
+    heap_pos[heap[j].id] = j;
+}
+
+static void heap_up(long i)
+{
+    while (i > 0 && heap[(i-1)/2].death > heap[i].death) {
+	heap_swap(i, (i-1)/2);
+	i = (i-1)/2;
+    }
+}
+
+static void heap_down(long i)
+{
+    long c;
+    while ((c = 2*i + 1) < num_live) {
+	if (c + 1 < num_live && heap[c+1].death < heap[c].death)
+	    c++;
+	if (heap[i].death <= heap[c].death)
+	    break;
+	heap_swap(i, c);
+	i = c;
+    }
+}
+
+static unsigned clamp(double size, unsigned maxsize)
+{
+    if (size < 1)
+	return 1;
+    if (size > maxsize)
+	return maxsize;
+    return (unsigned)size;
+}
+
+/*
+ * do_alloc - Allocate a block of a sampled size and lifetime
+ */
+static void do_alloc(phase_t *ph, unsigned long long now)
+{
+    unsigned id = num_free_ids ? free_ids[--num_free_ids] : num_ids++;
+    double life = sample(&ph->lifetime);
+
+    sizes[id] = clamp(sample(&ph->size), ph->maxsize);
+    heap[num_live].death = now + 1 + (life > 0 ? (unsigned long long)life : 0);
+    heap[num_live].id = id;
+    heap_pos[id] = num_live;
+    heap_up(num_live++);
+    emit(ph->calloc_p > 0 && rnd() < ph->calloc_p ? 'c' : 'a', id, sizes[id]);
+    live_bytes += sizes[id];
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * do_free - Free the block that is due soonest
+ */
+static void do_free(void)
+{
+    unsigned id = heap[0].id;
+
+    heap_swap(0, --num_live);
+    heap_down(0);
+    emit('f', id, 0);
+    live_bytes -= sizes[id];
+    free_ids[num_free_ids++] = id;
+}
+
+/*
+ * do_realloc - Resize a random live block
+ */
+static void do_realloc(phase_t *ph)
+{
+    unsigned id = heap[(long)(rnd() * num_live)].id;
+    unsigned size = clamp(sizes[id] * ph->realloc_factor, ph->maxsize);
+
+    if (size == sizes[id] && size < ph->maxsize)
+	size++;
+    live_bytes += size;
+    live_bytes -= sizes[id];
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+    sizes[id] = size;
+    emit('r', id, size);
+}
+
+int main(int argc, char **argv)
+{
+    char *outfile = NULL;
+    unsigned long long now = 0, seed = 0;
+    long i;
+    int c, p;
+
+    while ((c = getopt(argc, argv, "bs:o:h")) != -1) {
+	switch (c) {
+	case 'b': /* Write a binary trace */
+	    binary = 1;
+	    break;
+	case 's': /* Override the profile's random seed */
+	    seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'o': /* Output trace file */
+	    outfile = optarg;
+	    break;
+	case 'h':
+	    usage();
+	    exit(0);
+	default:
+	    usage();
+	    exit(1);
+	}
+    }
+    if (outfile == NULL || optind != argc - 1) {
+	usage();
+	exit(1);
+    }
+    read_profile(argv[optind]);
+    if (seed)
+	rng_state = seed;
+
+    /* Ids never exceed the largest live set, since freed ids are reused */
+    if ((heap = malloc(max_live * sizeof(block_t))) == NULL ||
+	(heap_pos = malloc(max_live * sizeof(long))) == NULL ||
+	(sizes = malloc(max_live * sizeof(unsigned))) == NULL ||
+	(free_ids = malloc(max_live * sizeof(unsigned))) == NULL)
+	unix_error("malloc failed in main");
+
+    if ((out = fopen(outfile, "w")) == NULL)
+	unix_error("Could not open output file");
+    write_header();
+
+    for (p = 0; p < num_phases; p++) {
+	phase_t *ph = &phases[p];
+	for (i = 0; i < ph->ops; i++, now++) {
+	    if (num_live > 0 && heap[0].death <= now)
+		do_free();
+	    else if (num_live > 0 && ph->realloc_p > 0 && rnd() < ph->realloc_p)
+		do_realloc(ph);
+	    else if (num_live < ph->live)
+		do_alloc(ph, now);
+	    else
+		do_free();
+	}
+    }
+    /* Balance the trace */
+    while (num_live > 0)
+	do_free();
+
+    write_header();
+    if (fclose(out) != 0)
+	unix_error("Write failed");
+    fprintf(stderr, "gen_trace: %s: %ld ops, %u ids, peak live %llu bytes\n",
+	    outfile, num_ops, num_ids, peak_bytes);
+    exit(0);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gen_trace [-hb] [-s <seed>] -o <tracefile> <profile>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b         Write a binary trace.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-o <file>  Write the trace to <file>.\n");
+    fprintf(stderr, "\t-s <seed>  Override the profile's random seed.\n");
+}
+
+static void app_error(char *msg)
+{
+    fprintf(stderr, "gen_trace: %s\n", msg);
+    exit(1);
+}
+
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}